@@ -0,0 +1,65 @@
+#ifndef ADAPTIVE_HEADER_H
+#define ADAPTIVE_HEADER_H
+
+#include "Vec3.hpp"
+
+#include <cmath>
+
+// Adaptive sampling settings. A pixel stops taking samples once it has at
+// least min_spp and the standard error of its mean, measured after the
+// gamma 2 display transform, is below threshold; noisy pixels keep going up
+// to max_spp.
+struct AdaptiveSettings
+{
+    bool enabled = false;
+    int min_spp = 16;
+    int max_spp = 0;
+    double threshold = 0.004;
+    // Convergence is checked after every batch of this many samples.
+    int batch = 8;
+};
+
+// Running mean and variance of a pixel's luminance (Welford's method).
+struct PixelEstimate
+{
+    int n = 0;
+    double mean = 0.0;
+    double m2 = 0.0;
+
+    void add(double x)
+    {
+        n++;
+        const double delta = x - mean;
+        mean += delta / n;
+        m2 += delta * (x - mean);
+    }
+
+    // Standard error of the mean, propagated through the sqrt() that maps
+    // linear radiance to display values.
+    double display_error() const
+    {
+        if (n < 2)
+            return INFINITY;
+        const double variance = m2 / (n - 1);
+        return sqrt(variance / n) / (2.0 * sqrt(fmax(mean, 0.0)) + 1e-4);
+    }
+};
+
+// Rec. 709 luminance.
+inline double Luminance(const Vec3 &c)
+{
+    return 0.2126 * c.x + 0.7152 * c.y + 0.0722 * c.z;
+};
+
+// Map t in [0, 1] onto a blue-green-yellow-red ramp for sample count heatmaps.
+inline Vec3 HeatColor(double t)
+{
+    t = fmin(fmax(t, 0.0), 1.0);
+    if (t < 1.0 / 3.0)
+        return Vec3(0, 3 * t, 1 - 3 * t);
+    if (t < 2.0 / 3.0)
+        return Vec3(3 * t - 1, 1, 0);
+    return Vec3(1, 3 - 3 * t, 0);
+};
+
+#endif
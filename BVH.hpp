@@ -0,0 +1,400 @@
+#ifndef BVH_HEADER_H
+#define BVH_HEADER_H
+
+#include "Ray.hpp"
+#include "Vec3.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+// Axis-aligned bounding box.
+struct AABB
+{
+    Vec3 min = Vec3(INFINITY, INFINITY, INFINITY);
+    Vec3 max = Vec3(-INFINITY, -INFINITY, -INFINITY);
+
+    AABB() = default;
+    AABB(const Vec3 &lo, const Vec3 &hi) : min(lo), max(hi) {}
+
+    // Comparisons rather than fmin and fmax, which are library calls where
+    // NaNs must be handled; a build over millions of triangles grows boxes
+    // hundreds of millions of times.
+    void grow(const Vec3 &p)
+    {
+        min = Vec3(p.x < min.x ? p.x : min.x, p.y < min.y ? p.y : min.y, p.z < min.z ? p.z : min.z);
+        max = Vec3(p.x > max.x ? p.x : max.x, p.y > max.y ? p.y : max.y, p.z > max.z ? p.z : max.z);
+    }
+
+    void grow(const AABB &b)
+    {
+        min = Vec3(b.min.x < min.x ? b.min.x : min.x, b.min.y < min.y ? b.min.y : min.y,
+                   b.min.z < min.z ? b.min.z : min.z);
+        max = Vec3(b.max.x > max.x ? b.max.x : max.x, b.max.y > max.y ? b.max.y : max.y,
+                   b.max.z > max.z ? b.max.z : max.z);
+    }
+
+    Vec3 centroid() const
+    {
+        return 0.5 * (min + max);
+    }
+
+    bool empty() const
+    {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    double surface_area() const
+    {
+        if (empty())
+            return 0.0;
+        const Vec3 d = max - min;
+        return 2.0 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    // Slab test. Returns the entry distance, or INFINITY on a miss. Exit
+    // distances are multiplied by slack, which a little over 1 makes up for
+    // their rounding, so that a ray grazing the box is never lost.
+    Real hit(const Ray &ray, const Vec3 &inv_dir, Real tmin, Real tmax, Real slack = 1) const
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            Real t0 = (min[a] - ray.orig[a]) * inv_dir[a];
+            Real t1 = (max[a] - ray.orig[a]) * inv_dir[a];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            t1 *= slack;
+            // NaNs (origin on the slab with a zero direction) leave the range untouched.
+            tmin = t0 > tmin ? t0 : tmin;
+            tmax = t1 < tmax ? t1 : tmax;
+            if (tmax < tmin)
+                return INFINITY;
+        }
+        return tmin;
+    }
+};
+
+// Flattened BVH node. Interior nodes store their first child right after
+// themselves and the index of the second child in offset; leaves store the
+// range [offset, offset + count) of the reordered primitive array.
+struct BVHNode
+{
+    AABB bounds;
+    int offset;
+    int count;
+
+    bool leaf() const { return count > 0; }
+};
+
+// Build-time statistics.
+struct BVHStats
+{
+    int nodes = 0;
+    int leaves = 0;
+    int depth = 0;
+    double sah_cost = 0.0;
+};
+
+// Bounding volume hierarchy built with the binned surface area heuristic.
+class BVH
+{
+private:
+    static const int bin_count = 16;
+    static constexpr double traversal_cost = 1.0;
+    // Traversal keeps a stack of 64 deferred nodes, which no leaf deeper
+    // than this can overflow.
+    static const int max_depth = 63;
+
+    struct BuildItem
+    {
+        AABB bounds;
+        Vec3 centroid;
+        int index;
+    };
+
+    int build_recursive(std::vector<BuildItem> &items, int begin, int end, int depth)
+    {
+        const int node_index = static_cast<int>(nodes.size());
+        nodes.push_back(BVHNode());
+        stats.depth = std::max(stats.depth, depth);
+
+        AABB bounds, centroid_bounds;
+        for (int i = begin; i < end; i++)
+        {
+            bounds.grow(items[i].bounds);
+            centroid_bounds.grow(items[i].centroid);
+        }
+        nodes[node_index].bounds = bounds;
+
+        const int count = end - begin;
+        const double leaf_cost = intersect_cost * count;
+
+        // Find the cheapest binned split over all three axes.
+        int best_axis = -1, best_split = 0;
+        double best_cost = INFINITY;
+        for (int axis = 0; axis < 3 && count > 1; axis++)
+        {
+            const double lo = centroid_bounds.min[axis];
+            const double extent = centroid_bounds.max[axis] - lo;
+            if (!(extent > 0.0))
+                continue;
+
+            AABB bin_bounds[bin_count];
+            int bin_counts[bin_count] = {0};
+            for (int i = begin; i < end; i++)
+            {
+                const int b = std::min(bin_count - 1, static_cast<int>(bin_count * (items[i].centroid[axis] - lo) / extent));
+                bin_bounds[b].grow(items[i].bounds);
+                bin_counts[b]++;
+            }
+
+            // Sweep from the right to get the cost of each suffix, then from the left.
+            double right_area[bin_count];
+            int right_count[bin_count];
+            AABB acc;
+            int n = 0;
+            for (int b = bin_count - 1; b > 0; b--)
+            {
+                acc.grow(bin_bounds[b]);
+                n += bin_counts[b];
+                right_area[b] = acc.surface_area();
+                right_count[b] = n;
+            }
+            acc = AABB();
+            n = 0;
+            for (int b = 0; b < bin_count - 1; b++)
+            {
+                acc.grow(bin_bounds[b]);
+                n += bin_counts[b];
+                if (n == 0 || right_count[b + 1] == 0)
+                    continue;
+                const double cost = traversal_cost + intersect_cost *
+                    (acc.surface_area() * n + right_area[b + 1] * right_count[b + 1]) / bounds.surface_area();
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = b;
+                }
+            }
+        }
+
+        // Make a leaf when splitting does not pay off.
+        if (best_axis < 0 || (best_cost >= leaf_cost && count <= max_leaf_size) || !std::isfinite(best_cost) ||
+            depth >= max_depth)
+        {
+            nodes[node_index].offset = begin;
+            nodes[node_index].count = count;
+            return node_index;
+        }
+
+        const double lo = centroid_bounds.min[best_axis];
+        const double extent = centroid_bounds.max[best_axis] - lo;
+        BuildItem *mid = std::partition(items.data() + begin, items.data() + end, [&](const BuildItem &item) {
+            const int b = std::min(bin_count - 1, static_cast<int>(bin_count * (item.centroid[best_axis] - lo) / extent));
+            return b <= best_split;
+        });
+        const int split = static_cast<int>(mid - items.data());
+
+        nodes[node_index].count = 0;
+        build_recursive(items, begin, split, depth + 1);
+        nodes[node_index].offset = build_recursive(items, split, end, depth + 1);
+        return node_index;
+    }
+
+public:
+    std::vector<BVHNode> nodes;
+    BVHStats stats;
+    // Cost of testing one primitive next to a traversal step, and the most
+    // primitives a leaf keeps when splitting does not pay off. The defaults
+    // suit spheres, which the vector kernel tests several per instruction.
+    double intersect_cost = 0.5;
+    int max_leaf_size = 8;
+    // Slack of the node tests; see AABB::hit(). Primitives whose own test
+    // is watertight need it, since rays through their shared edges and
+    // corners pass right along the boxes' faces.
+    Real slack = 1;
+
+    // Build the hierarchy over the given primitive bounds. On return order[i]
+    // holds the original index of the primitive that belongs in slot i, and
+    // callers must reorder their primitive arrays to match.
+    void build(const std::vector<AABB> &bounds, std::vector<int> &order)
+    {
+        nodes.clear();
+        stats = BVHStats();
+        order.clear();
+        if (bounds.empty())
+            return;
+
+        std::vector<BuildItem> items(bounds.size());
+        for (size_t i = 0; i < bounds.size(); i++)
+            items[i] = BuildItem{bounds[i], bounds[i].centroid(), static_cast<int>(i)};
+
+        nodes.reserve(2 * bounds.size());
+        build_recursive(items, 0, static_cast<int>(items.size()), 0);
+
+        for (const BuildItem &item : items)
+            order.push_back(item.index);
+
+        // Gather statistics.
+        stats.nodes = static_cast<int>(nodes.size());
+        for (const BVHNode &node : nodes)
+            stats.leaves += node.leaf();
+        stats.sah_cost = sah_cost();
+    }
+
+    // Recompute the node bounds for primitives that moved, keeping the tree.
+    // bounds is in the reordered slot order. Children are stored after
+    // their parents, so one backward pass sees every child first.
+    void refit(const std::vector<AABB> &bounds)
+    {
+        for (int n = static_cast<int>(nodes.size()) - 1; n >= 0; n--)
+        {
+            BVHNode &node = nodes[n];
+            AABB box;
+            if (node.leaf())
+            {
+                for (int i = node.offset; i < node.offset + node.count; i++)
+                    box.grow(bounds[i]);
+            }
+            else
+            {
+                box.grow(nodes[n + 1].bounds);
+                box.grow(nodes[node.offset].bounds);
+            }
+            node.bounds = box;
+        }
+        stats.sah_cost = sah_cost();
+    }
+
+    // Expected cost of a ray through the tree under the surface area heuristic.
+    double sah_cost() const
+    {
+        if (nodes.empty())
+            return 0.0;
+        const double root_area = nodes[0].bounds.surface_area();
+        double cost = 0.0;
+        for (const BVHNode &node : nodes)
+        {
+            const double p = root_area > 0.0 ? node.bounds.surface_area() / root_area : 1.0;
+            if (node.leaf())
+                cost += p * intersect_cost * node.count;
+            else
+                cost += p * traversal_cost;
+        }
+        return cost;
+    }
+
+    void print_stats(FILE *out) const
+    {
+        fprintf(out, "BVH: %d nodes, %d leaves, depth %d, SAH cost %.3f\n",
+                stats.nodes, stats.leaves, stats.depth, stats.sah_cost);
+    }
+
+    // Walk the hierarchy front to back. intersect_leaf(first, count, tmax)
+    // tests a primitive range, shrinks tmax on a closer hit and returns
+    // whether it found one; subtrees beyond the current tmax are culled.
+    template <typename F>
+    bool traverse(const Ray &ray, Real tmin, Real &tmax, F &&intersect_leaf) const
+    {
+        if (nodes.empty())
+            return false;
+
+        const Vec3 inv_dir(1 / ray.dir.x, 1 / ray.dir.y, 1 / ray.dir.z);
+        if (nodes[0].bounds.hit(ray, inv_dir, tmin, tmax, slack) == INFINITY)
+            return false;
+
+        struct Entry
+        {
+            int node;
+            Real t;
+        };
+        Entry stack[64];
+        int top = 0;
+        int current = 0;
+        bool hit = false;
+        while (true)
+        {
+            const BVHNode &node = nodes[current];
+            if (node.leaf())
+            {
+                hit |= intersect_leaf(node.offset, node.count, tmax);
+            }
+            else
+            {
+                const int first = current + 1;
+                const int second = node.offset;
+                const Real t_first = nodes[first].bounds.hit(ray, inv_dir, tmin, tmax, slack);
+                const Real t_second = nodes[second].bounds.hit(ray, inv_dir, tmin, tmax, slack);
+                if (t_first != INFINITY && t_second != INFINITY)
+                {
+                    // Visit the nearer child first and defer the other.
+                    if (t_first <= t_second)
+                    {
+                        stack[top++] = Entry{second, t_second};
+                        current = first;
+                    }
+                    else
+                    {
+                        stack[top++] = Entry{first, t_first};
+                        current = second;
+                    }
+                    continue;
+                }
+                if (t_first != INFINITY)
+                {
+                    current = first;
+                    continue;
+                }
+                if (t_second != INFINITY)
+                {
+                    current = second;
+                    continue;
+                }
+            }
+
+            // Pop the next deferred node, skipping those entered beyond tmax.
+            do
+            {
+                if (top == 0)
+                    return hit;
+                top--;
+            } while (stack[top].t > tmax);
+            current = stack[top].node;
+        }
+    }
+
+    // Walk the hierarchy until intersect_leaf(first, count) reports a hit
+    // in [tmin, tmax], for shadow rays, which need any hit rather than the
+    // nearest. Children are taken in node order and nothing is sorted.
+    template <typename F>
+    bool traverse_any(const Ray &ray, Real tmin, Real tmax, F &&intersect_leaf) const
+    {
+        if (nodes.empty())
+            return false;
+
+        const Vec3 inv_dir(1 / ray.dir.x, 1 / ray.dir.y, 1 / ray.dir.z);
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const BVHNode &node = nodes[stack[--top]];
+            if (node.bounds.hit(ray, inv_dir, tmin, tmax, slack) == INFINITY)
+                continue;
+            if (node.leaf())
+            {
+                if (intersect_leaf(node.offset, node.count))
+                    return true;
+                continue;
+            }
+            const int first = static_cast<int>(&node - nodes.data()) + 1;
+            stack[top++] = node.offset;
+            stack[top++] = first;
+        }
+        return false;
+    }
+};
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef BOX_HEADER_H
+#define BOX_HEADER_H
+
+#include "BVH.hpp"
+#include "HitRecord.hpp"
+#include "Primitive.hpp"
+#include "Ray.hpp"
+#include "Vec3.hpp"
+
+#include <cmath>
+
+// Box class. An axis-aligned box between the corners lo and hi. Seen from
+// inside it is a room: a ray starting within it hits the wall it leaves
+// through, with the normal turned to face the ray as for any back face.
+class Box : public Primitive
+{
+public:
+    Vec3 lo, hi;
+    Box() {}
+    Box(Vec3 l, Vec3 h, Vec3 col, int m) : Primitive(col, m), lo(l), hi(h) {}
+
+    // Bounding box of the box.
+    AABB bounds() const
+    {
+        return AABB(lo, hi);
+    }
+
+    // Slab test: the distances at which the ray enters and leaves the box,
+    // and the axes of the faces it does so through. A miss leaves
+    // tnear > tfar.
+    void slabs(const Ray &ray, Real &tnear, Real &tfar, int &near_axis, int &far_axis) const
+    {
+        tnear = -INFINITY;
+        tfar = INFINITY;
+        near_axis = far_axis = 0;
+        for (int a = 0; a < 3; a++)
+        {
+            const Real inv = 1 / ray.dir[a];
+            Real t0 = (lo[a] - ray.orig[a]) * inv;
+            Real t1 = (hi[a] - ray.orig[a]) * inv;
+            if (t0 > t1)
+                std::swap(t0, t1);
+            if (t0 > tnear)
+            {
+                tnear = t0;
+                near_axis = a;
+            }
+            if (t1 < tfar)
+            {
+                tfar = t1;
+                far_axis = a;
+            }
+        }
+    }
+
+    // Determine whether the ray hits the box within [tmin, tmax], and if so
+    // lower tmax to the hit distance.
+    bool intersect(const Ray &ray, Real tmin, Real &tmax) const
+    {
+        Real tnear, tfar;
+        int near_axis, far_axis;
+        slabs(ray, tnear, tfar, near_axis, far_axis);
+        if (tnear > tfar)
+            return false;
+
+        // The entry face if it is in range, otherwise the exit face.
+        const Real t = tnear >= tmin ? tnear : tfar;
+        if (t < tmin || t > tmax)
+            return false;
+        tmax = t;
+        return true;
+    }
+
+    // Store the hit point, hit distance, normal, front face and texture
+    // coordinates of the hit at distance t in the hit record. The slab
+    // test is repeated to find the face; a hit on the entry face is one
+    // at the entry distance.
+    void interact(const Ray &ray, Real t, HitRecord &rec) const
+    {
+        Real tnear, tfar;
+        int near_axis, far_axis;
+        slabs(ray, tnear, tfar, near_axis, far_axis);
+        rec.front = t == tnear;
+        const int axis = rec.front ? near_axis : far_axis;
+
+        rec.t = t;
+        rec.p = ray.at(t);
+        // A ray enters by the high face when moving down the axis and
+        // leaves by it when moving up.
+        const bool high = (ray.dir[axis] < 0) == rec.front;
+        rec.p[axis] = high ? hi[axis] : lo[axis];
+        Vec3 out_N;
+        out_N[axis] = high ? 1 : -1;
+        rec.normal = rec.front ? out_N : -out_N;
+        GetFlatUV(rec.p, axis, rec.u, rec.v);
+        rec.width = ray.width + ray.spread * t * ray.dir.length();
+        rec.du = rec.width;
+        rec.dv = rec.width;
+        rec.curvature = 0;
+    }
+
+    // Determine whether the ray hits the box, and store the hit point,
+    // hit distance, normal, and front face in the hit record.
+    bool hit(const Ray &ray, HitRecord &rec, Real tmin, Real tmax) const
+    {
+        if (!intersect(ray, tmin, tmax))
+            return false;
+        interact(ray, tmax, rec);
+        return true;
+    }
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define CAMERA_HEADER_H
 
 #include "Ray.hpp"
+#include "Sampler.hpp"
 #include "Vec3.hpp"
 #include "utils.hpp"
 
@@ -14,36 +15,51 @@ private:
     Vec3 horizontal;
     Vec3 vertical;
     Vec3 u, v, w;
-    double radius;
+    Real radius;
+    double half_height;
+    Real pixel_spread = 0;
 
 public:
-    Camera(Vec3 eye, Vec3 lookat, Vec3 up, double vfov, double aspect,
+    // The camera is set up in double precision from the scene description
+    // and kept in the renderer's precision.
+    Camera(const Vec3d &eye, const Vec3d &lookat, const Vec3d &up, double vfov, double aspect,
            double aperture, double focusdist)
     {
 
         // Positioning and orientating the camera.
-        origin = eye;
         radius = aperture / 2;
 
         const double theta = DegtoRad(vfov);
-        const double half_height = tan(theta / 2);
+        half_height = tan(theta / 2);
         const double half_width = aspect * half_height;
 
-        Vec3 w = normalize(eye - lookat);
-        Vec3 u = normalize(cross(up, w));
-        Vec3 v = cross(w, u);
-        horizontal = 2 * half_width * u * focusdist;
-        vertical = 2 * half_height * v * focusdist;
-        lower_left_corner = origin - half_width * focusdist * u -
-                            half_height * focusdist * v - focusdist * w;
+        Vec3d w = normalize(eye - lookat);
+        Vec3d u = normalize(cross(up, w));
+        Vec3d v = cross(w, u);
+        origin = Vec3(eye);
+        horizontal = Vec3(2 * half_width * u * focusdist);
+        vertical = Vec3(2 * half_height * v * focusdist);
+        lower_left_corner = Vec3(eye - half_width * focusdist * u -
+                                 half_height * focusdist * v - focusdist * w);
     }
 
-    // Generate a ray for a given pixel.
-    Ray get_ray(double u, double v) const
+    // Set the angle a pixel subtends, which seeds the ray cones.
+    void set_resolution(int image_height)
     {
-        const Vec3 rd = radius * RandVecInUnitDisk();
+        pixel_spread = 2 * half_height / image_height;
+    }
+
+    // Generate a ray for a given pixel, sampling the lens with the next
+    // two of the sampler's numbers.
+    Ray get_ray(Real u, Real v, Sampler &sampler) const
+    {
+        double l1, l2;
+        sampler.next_2d(l1, l2);
+        const Vec3 rd = radius * SampleInUnitDisk(l1, l2);
         const Vec3 offset = u * rd.x + v * rd.y;
-        return Ray(origin + offset, lower_left_corner + u * horizontal + v * vertical - origin - offset);
+        Ray ray(origin + offset, lower_left_corner + u * horizontal + v * vertical - origin - offset);
+        ray.spread = pixel_spread;
+        return ray;
     }
 };
 
@@ -0,0 +1,208 @@
+#ifndef CHECKPOINT_HEADER_H
+#define CHECKPOINT_HEADER_H
+
+#include "TileScheduler.hpp"
+#include "Vec3.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// Hash of everything that affects pixel values, so a checkpoint is only
+// resumed by a render that would produce the same samples (FNV-1a).
+class Fingerprint
+{
+private:
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+public:
+    template <typename T>
+    Fingerprint &add(const T &value)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(&value);
+        for (size_t i = 0; i < sizeof(T); i++)
+        {
+            h ^= p[i];
+            h *= 0x100000001b3ULL;
+        }
+        return *this;
+    }
+
+    uint64_t value() const { return h; }
+};
+
+// Checkpoint of a render in progress. Workers report each finished tile;
+// a finished tile's pixels are never written again, so the checkpoint
+// thread can read them while the workers carry on with other tiles.
+//
+// File layout: the header, then for every finished tile its rectangle
+// followed by the radiance sums (three doubles) and sample counts
+// (int32) of its pixels in row order.
+class Checkpoint
+{
+private:
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        int32_t width;
+        int32_t height;
+        uint64_t fingerprint;
+        uint32_t tiles;
+    };
+
+    static const uint32_t version = 1;
+
+    std::mutex lock;
+    std::vector<Tile> completed;
+
+public:
+    // Record a tile whose pixels are final.
+    void add(const Tile &tile)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        completed.push_back(tile);
+    }
+
+    // Number of finished tiles.
+    size_t size()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return completed.size();
+    }
+
+    // Write every finished tile. The data goes to a temporary file that is
+    // synced and then renamed over path, so a crash never leaves a torn file.
+    bool write(const char *path, int width, int height, uint64_t fingerprint,
+               const Vec3 *accum, const int *samples)
+    {
+        std::vector<Tile> tiles;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            tiles = completed;
+        }
+
+        Header header;
+        memcpy(header.magic, "RTCK", 4);
+        header.version = version;
+        header.width = width;
+        header.height = height;
+        header.fingerprint = fingerprint;
+        header.tiles = static_cast<uint32_t>(tiles.size());
+
+        const std::string tmp = std::string(path) + ".tmp";
+        FILE *f = fopen(tmp.c_str(), "wb");
+        if (f == NULL)
+        {
+            fprintf(stderr, "ERROR: Could not open checkpoint '%s' for writing.\n", tmp.c_str());
+            return false;
+        }
+
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+        std::vector<double> sums;
+        std::vector<int32_t> counts;
+        for (const Tile &tile : tiles)
+        {
+            const int32_t rect[4] = {tile.x0, tile.y0, tile.x1, tile.y1};
+            sums.clear();
+            counts.clear();
+            for (int j = tile.y0; j < tile.y1; j++)
+            {
+                for (int i = tile.x0; i < tile.x1; i++)
+                {
+                    const int index = (height - j - 1) * width + i;
+                    sums.push_back(accum[index].x);
+                    sums.push_back(accum[index].y);
+                    sums.push_back(accum[index].z);
+                    counts.push_back(samples[index]);
+                }
+            }
+            ok = ok && fwrite(rect, sizeof(rect), 1, f) == 1;
+            ok = ok && fwrite(sums.data(), sizeof(double), sums.size(), f) == sums.size();
+            ok = ok && fwrite(counts.data(), sizeof(int32_t), counts.size(), f) == counts.size();
+        }
+        ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+        ok = (fclose(f) == 0) && ok;
+        if (ok)
+            ok = rename(tmp.c_str(), path) == 0;
+        if (!ok)
+        {
+            fprintf(stderr, "ERROR: Could not write checkpoint '%s'.\n", path);
+            remove(tmp.c_str());
+        }
+        return ok;
+    }
+
+    // Load a checkpoint written for the same image size and settings. The
+    // restored tiles are recorded as finished so later checkpoints keep them.
+    bool read(const char *path, int width, int height, uint64_t fingerprint,
+              Vec3 *accum, int *samples, std::vector<Tile> &tiles)
+    {
+        FILE *f = fopen(path, "rb");
+        if (f == NULL)
+        {
+            fprintf(stderr, "ERROR: Could not open checkpoint '%s'.\n", path);
+            return false;
+        }
+
+        Header header;
+        bool ok = fread(&header, sizeof(header), 1, f) == 1 && !memcmp(header.magic, "RTCK", 4) &&
+                  header.version == version;
+        if (ok && (header.width != width || header.height != height || header.fingerprint != fingerprint))
+        {
+            fprintf(stderr, "ERROR: Checkpoint '%s' was written with different render settings.\n", path);
+            fclose(f);
+            return false;
+        }
+
+        tiles.clear();
+        std::vector<double> sums;
+        std::vector<int32_t> counts;
+        for (uint32_t t = 0; ok && t < header.tiles; t++)
+        {
+            int32_t rect[4];
+            ok = fread(rect, sizeof(rect), 1, f) == 1;
+            const Tile tile{rect[0], rect[1], rect[2], rect[3]};
+            ok = ok && tile.x0 >= 0 && tile.y0 >= 0 && tile.x1 <= width && tile.y1 <= height &&
+                 tile.x0 < tile.x1 && tile.y0 < tile.y1;
+            if (!ok)
+                break;
+
+            sums.resize(3 * tile.pixels());
+            counts.resize(tile.pixels());
+            ok = fread(sums.data(), sizeof(double), sums.size(), f) == sums.size() &&
+                 fread(counts.data(), sizeof(int32_t), counts.size(), f) == counts.size();
+            if (!ok)
+                break;
+
+            int k = 0;
+            for (int j = tile.y0; j < tile.y1; j++)
+            {
+                for (int i = tile.x0; i < tile.x1; i++, k++)
+                {
+                    const int index = (height - j - 1) * width + i;
+                    accum[index] = Vec3(sums[3 * k], sums[3 * k + 1], sums[3 * k + 2]);
+                    samples[index] = counts[k];
+                }
+            }
+            tiles.push_back(tile);
+        }
+        fclose(f);
+
+        if (!ok)
+        {
+            fprintf(stderr, "ERROR: Checkpoint '%s' is corrupt.\n", path);
+            return false;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        completed = tiles;
+        return true;
+    }
+};
+
+#endif
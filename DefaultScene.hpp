@@ -0,0 +1,89 @@
+#ifndef DEFAULTSCENE_HEADER_H
+#define DEFAULTSCENE_HEADER_H
+
+#include "Random.hpp"
+#include "SceneFile.hpp"
+#include "Vec3.hpp"
+#include "utils.hpp"
+
+// Define global color vectors.
+const Vec3d WHITE = Vec3d(1, 1, 1);
+const Vec3d WHITEGRAY = Vec3d(0.9, 0.9, 0.9);
+const Vec3d GRAY = Vec3d(0.5, 0.5, 0.5);
+const Vec3d SILVER = Vec3d(0.75, 0.75, 0.75);
+const Vec3d BLACK = Vec3d();
+const Vec3d BLUE = Vec3d(0, 0.75, 1);
+const Vec3d PURPLE = Vec3d(0.5, 0, 1.0);
+
+// Set up the scence.
+inline SceneDescription SetUpScene()
+{
+    SceneDescription scene;
+
+    // Load image textures.
+    const int earth = scene.image("earth.jpeg");
+    const int mars = scene.image("mars.jpeg");
+    const int moon = scene.image("moon.jpeg");
+
+    // Fixed seed so the random spheres are the same on every run.
+    Rng rng(2020);
+
+    // Build the room: floor, ceiling light and four walls. A material of -1
+    // marks the light.
+    const int wall = scene.metal(Vec3d(1, 1, 1), 0.8);
+    scene.plane(1, 0, GRAY, scene.lambertian(scene.checker(scene.constant(GRAY), scene.constant(BLACK))));
+    scene.plane(1, 25, WHITEGRAY, -1);
+    scene.plane(0, 0, PURPLE, wall);
+    scene.plane(0, 100, PURPLE, wall);
+    scene.plane(2, -50, PURPLE, wall);
+    scene.plane(2, 50, PURPLE, wall);
+
+    // Build the spheres.
+    scene.sphere(Vec3d(-6.5 + 50, 6, -2), 6, SILVER, scene.metal(Vec3d(1, 1, 1), 0.05));
+    scene.sphere(Vec3d(4.5 + 50, 4, -2), 4, BLUE, scene.lambertian(scene.constant(BLUE)));
+    scene.sphere(Vec3d(50, 3, 5), 3, WHITE, scene.dielectric(1.5));
+    scene.sphere(Vec3d(50, 2, 11), 2, WHITE, scene.lambertian(earth));
+    scene.sphere(Vec3d(-6 + 50, 2, 7), 2, WHITE, scene.lambertian(mars));
+    scene.sphere(Vec3d(6 + 50, 2, 7), 2, WHITE, scene.lambertian(moon));
+
+    // Add random Spheres.
+    for (int i = 0; i < 50; i++)
+    {
+        // Set x coordinate.
+        double x = RandDouble(rng);
+        if (x < 0.5)
+            x = RandDouble(rng, 0, 43);
+        else
+            x = RandDouble(rng, 56, 100);
+        // Set z coordinate.
+        double z = RandDouble(rng);
+        if (z < 0.5)
+            z = RandDouble(rng, -20, -3);
+        else
+            z = RandDouble(rng, 12, 20);
+        // Set radius.
+        double r = RandDouble(rng, 0.2, 1);
+        // Set location and color.
+        Vec3d location(x, r, z);
+        const double red = RandDouble(rng);
+        const double green = RandDouble(rng);
+        const double blue = RandDouble(rng);
+        Vec3d color(red, green, blue);
+        double rand = RandDouble(rng);
+        if (rand < 0.45)
+        {
+            scene.sphere(location, r, color, scene.lambertian(scene.constant(color)));
+        }
+        else if (rand < 0.75)
+        {
+            scene.sphere(location, r, color, scene.metal(Vec3d(1, 1, 1), 0.1));
+        }
+        else
+        {
+            scene.sphere(location, r, color, scene.dielectric(1.5));
+        }
+    }
+    return scene;
+};
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef DENOISER_HEADER_H
+#define DENOISER_HEADER_H
+
+#include "Adaptive.hpp"
+#include "PathTracer.hpp"
+#include "Vec3.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+// Auxiliary buffers of a render, laid out like the accumulation buffer:
+// per-pixel sums over the samples of the first hit's albedo, normal and
+// depth, and of the squared luminance of the colour, for its variance.
+struct AuxBuffers
+{
+    std::vector<Vec3> albedo;
+    std::vector<Vec3> normal;
+    std::vector<double> depth;
+    std::vector<double> moment;
+
+    void reset(int pixels)
+    {
+        albedo.assign(pixels, Vec3());
+        normal.assign(pixels, Vec3());
+        depth.assign(pixels, 0.0);
+        moment.assign(pixels, 0.0);
+    }
+
+    bool empty() const { return albedo.empty(); }
+};
+
+// Per-sample sums of one pixel's auxiliary values.
+struct AuxSum
+{
+    Vec3 albedo, normal;
+    double depth = 0.0, moment = 0.0;
+
+    void add(const FirstHit &first, const Vec3 &color)
+    {
+        albedo += first.albedo;
+        normal += first.normal;
+        depth += first.depth;
+        const double l = Luminance(color);
+        moment += l * l;
+    }
+
+    // Continue from the sums stored for an earlier pass.
+    void load(const AuxBuffers &aux, int index)
+    {
+        albedo = aux.albedo[index];
+        normal = aux.normal[index];
+        depth = aux.depth[index];
+        moment = aux.moment[index];
+    }
+
+    void store(AuxBuffers &aux, int index) const
+    {
+        aux.albedo[index] = albedo;
+        aux.normal[index] = normal;
+        aux.depth[index] = depth;
+        aux.moment[index] = moment;
+    }
+};
+
+// Resolved auxiliary images, one value per pixel: mean albedo, normal and
+// depth, and the variance of the pixel's mean luminance.
+struct AuxImages
+{
+    std::vector<Vec3> albedo;
+    std::vector<Vec3> normal;
+    std::vector<float> depth;
+    std::vector<float> variance;
+
+    void resolve(const AuxBuffers &aux, const Vec3 *accum, const int *samples, int pixels)
+    {
+        albedo.resize(pixels);
+        normal.resize(pixels);
+        depth.resize(pixels);
+        variance.resize(pixels);
+        for (int i = 0; i < pixels; i++)
+        {
+            const int n = samples[i];
+            if (n == 0)
+            {
+                albedo[i] = normal[i] = Vec3();
+                depth[i] = variance[i] = 0.0f;
+                continue;
+            }
+            albedo[i] = aux.albedo[i] / n;
+            // Normals averaged across an edge are shorter; renormalise.
+            const Real len = aux.normal[i].length();
+            normal[i] = len > 0 ? aux.normal[i] / len : Vec3();
+            depth[i] = static_cast<float>(aux.depth[i] / n);
+            // Variance of the mean from the sample moments. A single sample
+            // says nothing about its spread, so it is taken to be as large
+            // as the value itself.
+            const double mean = Luminance(accum[i]) / n;
+            const double var = n > 1 ? std::max(0.0, aux.moment[i] / n - mean * mean) / (n - 1) : mean * mean;
+            variance[i] = static_cast<float>(var);
+        }
+    }
+};
+
+// Denoiser settings. The sigmas scale how quickly a neighbour's weight
+// falls off with its difference from the pixel being filtered.
+struct DenoiseSettings
+{
+    int iterations = 5;
+    // In standard deviations of the pixel's luminance.
+    float sigma_luminance = 4.0f;
+    // Exponent on the cosine between normals.
+    float sigma_normal = 128.0f;
+    // In units of the local depth gradient.
+    float sigma_depth = 1.0f;
+    // In albedo units, on the largest channel difference.
+    float sigma_albedo = 0.1f;
+};
+
+// Edge-avoiding a-trous wavelet denoiser (Dammertz et al. 2010), with the
+// variance-guided luminance weight of SVGF (Schied et al. 2017). The
+// colour is divided by the albedo, so that texture detail does not get
+// blurred and only the lighting is filtered, and is then filtered by a
+// 5x5 B3-spline kernel whose taps spread twice as far every iteration.
+// Each tap is weighted down by how much its luminance differs relative to
+// the noise and how much its normal, depth and albedo differ, so the
+// filter smooths within surfaces but not across their edges. The rows of
+// each iteration are shared out between threads. color and out hold
+// three floats per pixel, top row first.
+inline void Denoise(const float *color, const AuxImages &aux, int width, int height, int threads,
+                    const DenoiseSettings &settings, float *out)
+{
+    const int pixels = width * height;
+    const float albedo_floor = 0.01f;
+
+    // Run rows(y) over every row on a pool of threads.
+    auto parallel_rows = [&](auto &&rows) {
+        std::vector<std::thread> pool;
+        const int n = std::max(1, std::min(threads, height));
+        for (int t = 0; t < n; t++)
+        {
+            pool.emplace_back([&, t]() {
+                for (int y = t; y < height; y += n)
+                    rows(y);
+            });
+        }
+        for (std::thread &th : pool)
+            th.join();
+    };
+
+    // Demodulate the albedo, and scale the variance to match.
+    std::vector<float> albedo(3 * pixels), irradiance(3 * pixels), variance(pixels);
+    for (int i = 0; i < pixels; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            albedo[3 * i + c] = std::max(static_cast<float>(aux.albedo[i][c]), albedo_floor);
+            irradiance[3 * i + c] = color[3 * i + c] / albedo[3 * i + c];
+        }
+        const float a = static_cast<float>(Luminance(Vec3(albedo[3 * i], albedo[3 * i + 1], albedo[3 * i + 2])));
+        variance[i] = aux.variance[i] / (a * a);
+    }
+
+    // Depth gradient, the larger of the central differences.
+    std::vector<float> gradient(pixels);
+    parallel_rows([&](int y) {
+        for (int x = 0; x < width; x++)
+        {
+            auto z = [&](int xx, int yy) {
+                return aux.depth[std::min(std::max(yy, 0), height - 1) * width + std::min(std::max(xx, 0), width - 1)];
+            };
+            gradient[y * width + x] = 0.5f * std::max(std::fabs(z(x + 1, y) - z(x - 1, y)), std::fabs(z(x, y + 1) - z(x, y - 1)));
+        }
+    });
+
+    const float kernel[3] = {3.0f / 8, 1.0f / 4, 1.0f / 16};
+    std::vector<float> next_irradiance(3 * pixels), next_variance(pixels), blurred(pixels);
+    for (int it = 0; it < settings.iterations; it++)
+    {
+        const int step = 1 << it;
+
+        // The luminance weight uses a 3x3 blur of the variance, which is
+        // itself noisy.
+        parallel_rows([&](int y) {
+            for (int x = 0; x < width; x++)
+            {
+                float sum = 0, wsum = 0;
+                for (int dy = -1; dy <= 1; dy++)
+                {
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        const int qx = x + dx, qy = y + dy;
+                        if (qx < 0 || qx >= width || qy < 0 || qy >= height)
+                            continue;
+                        const float w = (dx ? 0.25f : 0.5f) * (dy ? 0.25f : 0.5f);
+                        sum += w * variance[qy * width + qx];
+                        wsum += w;
+                    }
+                }
+                blurred[y * width + x] = sum / wsum;
+            }
+        });
+
+        parallel_rows([&](int y) {
+            for (int x = 0; x < width; x++)
+            {
+                const int p = y * width + x;
+                const float *ip = &irradiance[3 * p];
+                const float *ap = &albedo[3 * p];
+                const Vec3 &np = aux.normal[p];
+                const float zp = aux.depth[p];
+                const float lp = 0.2126f * ip[0] + 0.7152f * ip[1] + 0.0722f * ip[2];
+                const float lscale = settings.sigma_luminance * std::sqrt(blurred[p]) + 1e-6f;
+                const float zscale = settings.sigma_depth * gradient[p] * step + 1e-6f;
+
+                float sum[3] = {0, 0, 0};
+                float var = 0, wsum = 0;
+                for (int dy = -2; dy <= 2; dy++)
+                {
+                    const int qy = y + dy * step;
+                    if (qy < 0 || qy >= height)
+                        continue;
+                    for (int dx = -2; dx <= 2; dx++)
+                    {
+                        const int qx = x + dx * step;
+                        if (qx < 0 || qx >= width)
+                            continue;
+                        const int q = qy * width + qx;
+                        const float *iq = &irradiance[3 * q];
+                        const float *aq = &albedo[3 * q];
+
+                        float w = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+                        if (q != p)
+                        {
+                            const float lq = 0.2126f * iq[0] + 0.7152f * iq[1] + 0.0722f * iq[2];
+                            const float cosine = static_cast<float>(dot(np, aux.normal[q]));
+                            const float da = std::max(std::fabs(ap[0] - aq[0]), std::max(std::fabs(ap[1] - aq[1]), std::fabs(ap[2] - aq[2])));
+                            const float dz = std::fabs(zp - aux.depth[q]) / (zscale * (std::abs(dx) + std::abs(dy)));
+                            w *= cosine > 0 ? std::pow(cosine, settings.sigma_normal) : 0.0f;
+                            w *= std::exp(-std::fabs(lp - lq) / lscale - dz - da / settings.sigma_albedo);
+                        }
+                        sum[0] += w * iq[0];
+                        sum[1] += w * iq[1];
+                        sum[2] += w * iq[2];
+                        var += w * w * variance[q];
+                        wsum += w;
+                    }
+                }
+                for (int c = 0; c < 3; c++)
+                    next_irradiance[3 * p + c] = sum[c] / wsum;
+                next_variance[p] = var / (wsum * wsum);
+            }
+        });
+        irradiance.swap(next_irradiance);
+        variance.swap(next_variance);
+    }
+
+    // Put the albedo back.
+    for (int i = 0; i < 3 * pixels; i++)
+        out[i] = irradiance[i] * albedo[i];
+}
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef DISTRIBUTED_HEADER_H
+#define DISTRIBUTED_HEADER_H
+
+#include "Checkpoint.hpp"
+#include "TileScheduler.hpp"
+#include "Vec3.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Render job shared by any number of processes through a directory, on
+// one machine or on a shared filesystem. The directory holds
+//
+//   job                  fingerprint, image size and tile size of the render
+//   tile-<x0>-<y0>       a claim on the tile at (x0, y0), one per tile
+//   part-<host>-<pid>    a worker's partial accumulation file
+//
+// Workers claim tiles by creating their claim files exclusively, so every
+// tile is rendered by exactly one process, and keep their finished tiles
+// in a part file in the checkpoint format (radiance sums and sample
+// counts). Merging reads every part back into one accumulation buffer.
+// Samples are seeded per pixel, so the merged image is identical to one
+// rendered by a single process.
+class JobDirectory
+{
+private:
+    std::string dir;
+
+    static const uint32_t version = 1;
+
+    std::string path(const std::string &name) const { return dir + "/" + name; }
+
+    std::string claim_path(const Tile &tile) const
+    {
+        return path("tile-" + std::to_string(tile.x0) + "-" + std::to_string(tile.y0));
+    }
+
+    // Read the job file. Returns false if there is none or it is malformed.
+    bool read_job(uint64_t &fingerprint, int &width, int &height, int &tilesize) const
+    {
+        FILE *f = fopen(path("job").c_str(), "r");
+        if (f == NULL)
+            return false;
+        unsigned v = 0;
+        unsigned long long fp = 0;
+        const bool ok = fscanf(f, "RTJOB %u %llx %d %d %d", &v, &fp, &width, &height, &tilesize) == 5 &&
+                        v == version && tilesize > 0;
+        fclose(f);
+        fingerprint = fp;
+        return ok;
+    }
+
+public:
+    explicit JobDirectory(const char *d) : dir(d) {}
+
+    // Join the job, creating it if this is the first process. The job file
+    // is written in full and then linked into place, so the others never
+    // read it half written. A process joining an existing job adopts its
+    // tile size; a different scene, image size or render setting is an error.
+    bool join(uint64_t fingerprint, int width, int height, int &tilesize) const
+    {
+        if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST)
+        {
+            fprintf(stderr, "ERROR: Could not create job directory '%s'.\n", dir.c_str());
+            return false;
+        }
+
+        char host[256] = "host";
+        gethostname(host, sizeof(host) - 1);
+        const std::string tmp = path("job." + std::string(host) + "." + std::to_string(getpid()));
+        if (FILE *f = fopen(tmp.c_str(), "w"))
+        {
+            fprintf(f, "RTJOB %u %016llx %d %d %d\n", version, (unsigned long long)fingerprint, width, height, tilesize);
+            const bool ok = fclose(f) == 0;
+            if (ok && link(tmp.c_str(), path("job").c_str()) == 0)
+            {
+                unlink(tmp.c_str());
+                return true;
+            }
+            unlink(tmp.c_str());
+        }
+
+        uint64_t job_fingerprint;
+        int job_width, job_height, job_tilesize;
+        if (!read_job(job_fingerprint, job_width, job_height, job_tilesize))
+        {
+            fprintf(stderr, "ERROR: Could not read or create the job file in '%s'.\n", dir.c_str());
+            return false;
+        }
+        if (job_fingerprint != fingerprint || job_width != width || job_height != height)
+        {
+            fprintf(stderr, "ERROR: The job in '%s' renders a different scene or settings.\n", dir.c_str());
+            return false;
+        }
+        tilesize = job_tilesize;
+        return true;
+    }
+
+    // Claim a tile. Returns false if another process already has it.
+    bool claim(const Tile &tile) const
+    {
+        const int fd = open(claim_path(tile).c_str(), O_CREAT | O_EXCL | O_WRONLY, 0666);
+        if (fd < 0)
+            return false;
+        close(fd);
+        return true;
+    }
+
+    // Give up the claim on a tile left unfinished, for another process to take.
+    void release(const Tile &tile) const
+    {
+        unlink(claim_path(tile).c_str());
+    }
+
+    // Name of this process's part file.
+    std::string part_path() const
+    {
+        char host[256] = "host";
+        gethostname(host, sizeof(host) - 1);
+        return path("part-" + std::string(host) + "-" + std::to_string(getpid()));
+    }
+
+    // Merge every part file into accum and samples, marking the pixels
+    // merged in covered. Fails if the job is for other settings or two
+    // parts hold the same tile; tiles still missing are left uncovered.
+    bool merge(uint64_t fingerprint, int width, int height, Vec3 *accum, int *samples,
+               std::vector<char> &covered, int &parts) const
+    {
+        uint64_t job_fingerprint;
+        int job_width, job_height, job_tilesize;
+        if (!read_job(job_fingerprint, job_width, job_height, job_tilesize))
+        {
+            fprintf(stderr, "ERROR: '%s' holds no render job.\n", dir.c_str());
+            return false;
+        }
+        if (job_fingerprint != fingerprint || job_width != width || job_height != height)
+        {
+            fprintf(stderr, "ERROR: The job in '%s' renders a different scene or settings.\n", dir.c_str());
+            return false;
+        }
+
+        std::vector<std::string> names;
+        if (DIR *d = opendir(dir.c_str()))
+        {
+            while (const dirent *e = readdir(d))
+            {
+                // Part files being rewritten end in ".tmp"; their last
+                // complete version is still in place.
+                const std::string name = e->d_name;
+                if (name.compare(0, 5, "part-") == 0 &&
+                    (name.size() < 4 || name.compare(name.size() - 4, 4, ".tmp") != 0))
+                    names.push_back(name);
+            }
+            closedir(d);
+        }
+
+        covered.assign(width * height, 0);
+        parts = 0;
+        std::vector<Tile> tiles;
+        for (const std::string &name : names)
+        {
+            Checkpoint part;
+            if (!part.read(path(name).c_str(), width, height, fingerprint, accum, samples, tiles))
+                return false;
+            for (const Tile &tile : tiles)
+            {
+                for (int j = tile.y0; j < tile.y1; j++)
+                {
+                    for (int i = tile.x0; i < tile.x1; i++)
+                    {
+                        char &c = covered[(height - j - 1) * width + i];
+                        if (c)
+                        {
+                            fprintf(stderr, "ERROR: Part '%s' repeats the tile at (%d, %d).\n", name.c_str(),
+                                    tile.x0, tile.y0);
+                            return false;
+                        }
+                        c = 1;
+                    }
+                }
+            }
+            parts++;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -4,15 +4,45 @@
 #include "Ray.hpp"
 #include "Vec3.hpp"
 
-// HitRecord class.
+#include <cmath>
+
+// Kinds of primitive a scene holds, each kept in a list of its own.
+enum class PrimitiveKind : unsigned char
+{
+    None,
+    Sphere,
+    Plane,
+    Box,
+    Mesh
+};
+
+// Hit class. All that the search for the closest hit carries: the distance
+// along the ray and which primitive is there, by kind and index in the
+// scene's list of that kind, and on a mesh which of its triangles. The
+// surface is only evaluated, into a HitRecord, for the hit that wins.
+struct Hit
+{
+    Real t = INFINITY;
+    int index = -1;
+    int triangle = -1;
+    PrimitiveKind kind = PrimitiveKind::None;
+};
+
+// HitRecord class. The surface at the closest hit, as shading needs it.
 struct HitRecord
 {
-    float t;
-    double u;
-    double v;
+    Real t;
     Vec3 p;
     Vec3 normal;
     bool front = false;
+    Real u;
+    Real v;
+    // Width of the ray cone at the hit point, and that width in texture space.
+    Real width = 0;
+    Real du = 0;
+    Real dv = 0;
+    // Curvature of the surface, 1 / radius, which spreads reflected cones.
+    Real curvature = 0;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,209 @@
+#ifndef IMAGEIO_HEADER_H
+#define IMAGEIO_HEADER_H
+
+#include "Vec3.hpp"
+
+// Disable pedantic warnings for this external library.
+#ifdef _MSC_VER
+// Microsoft Visual C++ Compiler
+#pragma warning(push, 0)
+#endif
+
+// The implementation is compiled once, in stb_image.cpp.
+#include "external/stb_image_write.h"
+
+// Restore warning levels.
+#ifdef _MSC_VER
+// Microsoft Visual C++ Compiler
+#pragma warning(pop)
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Output image formats.
+enum class ImageFormat
+{
+    PPM,
+    PNG,
+    PFM
+};
+
+// Pick a format from a file extension or a bare name ("png", "out.pfm").
+// Anything unrecognised is written as binary PPM.
+inline ImageFormat ImageFormatFromName(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    const char *ext = dot ? dot + 1 : name;
+    if (!strcmp(ext, "png"))
+        return ImageFormat::PNG;
+    if (!strcmp(ext, "pfm"))
+        return ImageFormat::PFM;
+    return ImageFormat::PPM;
+};
+
+// Whether name holds a printf-style frame number such as "%04d": a
+// single %d conversion, optionally zero padded.
+inline bool HasFramePattern(const char *name)
+{
+    const char *percent = strchr(name, '%');
+    if (percent == NULL)
+        return false;
+    const char *p = percent + 1;
+    while (*p >= '0' && *p <= '9')
+        p++;
+    return *p == 'd' && strchr(p, '%') == NULL;
+};
+
+// Name of one frame's file in an animation. A name with a frame number
+// pattern such as "frame%04d.png" takes the frame there; any other name
+// gets it before the extension, "out.png" becoming "out-0003.png". "-"
+// (stdout) stays as it is, so frames stream out back to back.
+inline std::string FrameFileName(const char *name, int frame)
+{
+    if (!strcmp(name, "-"))
+        return name;
+    if (HasFramePattern(name))
+    {
+        char buf[4096];
+        snprintf(buf, sizeof(buf), name, frame);
+        return buf;
+    }
+    char number[16];
+    snprintf(number, sizeof(number), "-%04d", frame);
+    const std::string s = name;
+    const size_t dot = s.rfind('.');
+    const size_t slash = s.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return s + number;
+    return s.substr(0, dot) + number + s.substr(dot);
+};
+
+// Resolve an accumulation buffer (radiance sums and sample counts) into
+// mean linear radiance, three floats per pixel.
+inline void ResolveLinear(const Vec3 *accum, const int *samples, int count, float *linear)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const double scale = samples[i] > 0 ? 1.0 / samples[i] : 0.0;
+        linear[3 * i + 0] = static_cast<float>(accum[i].x * scale);
+        linear[3 * i + 1] = static_cast<float>(accum[i].y * scale);
+        linear[3 * i + 2] = static_cast<float>(accum[i].z * scale);
+    }
+};
+
+// Clamp to [0, 1], optionally apply the gamma 2 transform, and quantize to
+// bytes in one pass over the channel values.
+inline void Quantize(const float *values, size_t count, bool encode_gamma, unsigned char *bytes)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.999f);
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i q[4];
+        for (int k = 0; k < 4; k++)
+        {
+            __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(values + i + 4 * k), zero), one);
+            if (encode_gamma)
+                v = _mm_sqrt_ps(v);
+            q[k] = _mm_cvttps_epi32(_mm_mul_ps(v, scale));
+        }
+        const __m128i lo = _mm_packs_epi32(q[0], q[1]);
+        const __m128i hi = _mm_packs_epi32(q[2], q[3]);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(bytes + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        // Written so NaNs clamp to zero, like the vector path.
+        float v = values[i] > 0.0f ? values[i] : 0.0f;
+        v = v < 1.0f ? v : 1.0f;
+        if (encode_gamma)
+            v = sqrtf(v);
+        bytes[i] = static_cast<unsigned char>(255.999f * v);
+    }
+};
+
+// Encode an RGB float image (three channels per pixel, top row first)
+// into the bytes of an image file. PPM and PNG are clamped and quantized,
+// with the gamma 2 transform if encode_gamma is set; PFM stores the floats
+// unchanged.
+inline std::vector<unsigned char> EncodeImage(ImageFormat format, const float *rgb, int width, int height,
+                                              bool encode_gamma = true)
+{
+    const size_t channels = static_cast<size_t>(width) * height * 3;
+    std::vector<unsigned char> file;
+
+    if (format == ImageFormat::PFM)
+    {
+        // PFM rows run bottom to top, little-endian floats.
+        char header[64];
+        const int n = snprintf(header, sizeof(header), "PF\n%d %d\n-1.0\n", width, height);
+        file.assign(header, header + n);
+        const size_t row_bytes = sizeof(float) * 3 * width;
+        file.resize(n + row_bytes * height);
+        for (int y = 0; y < height; y++)
+            memcpy(file.data() + n + row_bytes * y, rgb + static_cast<size_t>(height - 1 - y) * 3 * width, row_bytes);
+    }
+    else
+    {
+        std::vector<unsigned char> bytes(channels);
+        Quantize(rgb, channels, encode_gamma, bytes.data());
+        if (format == ImageFormat::PNG)
+        {
+            auto append = [](void *context, void *data, int size) {
+                std::vector<unsigned char> &out = *static_cast<std::vector<unsigned char> *>(context);
+                const unsigned char *png = static_cast<const unsigned char *>(data);
+                out.insert(out.end(), png, png + size);
+            };
+            stbi_write_png_to_func(append, &file, width, height, 3, bytes.data(), 3 * width);
+        }
+        else
+        {
+            char header[64];
+            const int n = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+            file.assign(header, header + n);
+            file.insert(file.end(), bytes.begin(), bytes.end());
+        }
+    }
+    return file;
+};
+
+// Write an RGB float image to a file, encoded as by EncodeImage(). A
+// filename of "-" writes to stdout.
+inline bool WriteImage(const char *filename, ImageFormat format, const float *rgb,
+                       int width, int height, bool encode_gamma = true)
+{
+    const std::vector<unsigned char> file = EncodeImage(format, rgb, width, height, encode_gamma);
+    const bool to_stdout = !strcmp(filename, "-");
+    FILE *f = to_stdout ? stdout : fopen(filename, "wb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "ERROR: Could not open '%s' for writing.\n", filename);
+        return false;
+    }
+    const bool ok = fwrite(file.data(), 1, file.size(), f) == file.size();
+    if (to_stdout)
+        fflush(f);
+    else
+        fclose(f);
+    if (!ok)
+        fprintf(stderr, "ERROR: Could not write '%s'.\n", filename);
+    return ok;
+};
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef LIGHT_HEADER_H
+#define LIGHT_HEADER_H
+
+#include "HitRecord.hpp"
+#include "Vec3.hpp"
+#include "utils.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <variant>
+
+// A direction sampled towards a light: the unit direction, the distance to
+// the light along it, and the density of the direction per unit solid angle.
+struct LightSample
+{
+    Vec3 dir;
+    Real dist;
+    Real pdf;
+};
+
+// Sphere light. Seen from outside, directions are sampled uniformly in the
+// cone the sphere subtends; from inside, over every direction.
+class SphereLight final
+{
+public:
+    Vec3 center;
+    Real radius;
+    SphereLight(const Vec3 &c, Real r) : center(c), radius(std::fabs(r)) {}
+
+    bool sample(const Vec3 &p, Real u0, Real u1, Real u2, LightSample &s) const
+    {
+        const Vec3 d = center - p;
+        const Real dist2 = d.length_squared();
+        const Real r2 = radius * radius;
+        if (dist2 <= r2)
+        {
+            s.dir = SampleUnitVec(u1, u2);
+            const Real b = dot(p - center, s.dir);
+            s.dist = -b + std::sqrt(std::fmax(Real(0), b * b - (dist2 - r2)));
+            s.pdf = 1 / (4 * pi);
+            return true;
+        }
+
+        // 1 - cos(theta_max), written so that it keeps its precision for the
+        // narrow cones of small, distant lights.
+        const Real sin2_max = r2 / dist2;
+        const Real cos_max = std::sqrt(1 - sin2_max);
+        const Real cone = sin2_max / (1 + cos_max);
+        const Real one_minus_cos = u1 * cone;
+        const Real cos_theta = 1 - one_minus_cos;
+        const Real sin_theta = std::sqrt(std::fmax(Real(0), one_minus_cos * (2 - one_minus_cos)));
+        const Real phi = 2 * pi * u2;
+
+        const Real len = std::sqrt(dist2);
+        const Vec3 w = d / len;
+        Vec3 u, v;
+        OrthonormalBasis(w, u, v);
+        s.dir = sin_theta * std::cos(phi) * u + sin_theta * std::sin(phi) * v + cos_theta * w;
+        s.dist = len * cos_theta - std::sqrt(std::fmax(Real(0), r2 - dist2 * sin_theta * sin_theta));
+        s.pdf = 1 / (2 * pi * cone);
+        return true;
+    }
+
+    Real pdf(const Vec3 &p, const Vec3 &dir, const HitRecord &rec) const
+    {
+        const Real dist2 = (center - p).length_squared();
+        const Real r2 = radius * radius;
+        if (dist2 <= r2)
+            return 1 / (4 * pi);
+        const Real sin2_max = r2 / dist2;
+        return 1 / (2 * pi * sin2_max / (1 + std::sqrt(1 - sin2_max)));
+    }
+};
+
+// Infinite plane light. It fills the half of the sphere of directions that
+// faces it, which is sampled with a cosine about the plane's normal.
+class PlaneLight final
+{
+public:
+    int axis;
+    Real offset;
+    PlaneLight(int a, Real o) : axis(a), offset(o) {}
+
+    bool sample(const Vec3 &p, Real u0, Real u1, Real u2, LightSample &s) const
+    {
+        const Real h = offset - p[axis];
+        if (h == 0)
+            return false;
+        const Vec3 disk = SampleInUnitDisk(u1, u2);
+        const Real cos_theta = std::sqrt(std::fmax(Real(0), 1 - disk.x * disk.x - disk.y * disk.y));
+        if (cos_theta <= 0)
+            return false;
+        s.dir[(axis + 1) % 3] = disk.x;
+        s.dir[(axis + 2) % 3] = disk.y;
+        s.dir[axis] = h > 0 ? cos_theta : -cos_theta;
+        s.dist = std::fabs(h) / cos_theta;
+        s.pdf = cos_theta / pi;
+        return true;
+    }
+
+    Real pdf(const Vec3 &p, const Vec3 &dir, const HitRecord &rec) const
+    {
+        return std::fabs(dir[axis]) / (dir.length() * pi);
+    }
+};
+
+// Box light. Points are sampled uniformly over its surface, each face
+// picked by its area. Faces turned away from the point being lit are
+// hidden by the box itself, so their samples come back occluded. A box
+// flat along one axis is a two-sided rectangular light; its two faces
+// coincide, so every point on it is sampled through both.
+class BoxLight final
+{
+public:
+    Vec3 lo, hi;
+    Real area;
+    BoxLight(const Vec3 &l, const Vec3 &h) : lo(l), hi(h)
+    {
+        const Vec3 e = hi - lo;
+        area = 2 * (e.y * e.z + e.z * e.x + e.x * e.y);
+        if (e.x == 0 || e.y == 0 || e.z == 0)
+            area /= 2;
+    }
+
+    bool sample(const Vec3 &p, Real u0, Real u1, Real u2, LightSample &s) const
+    {
+        if (area <= 0)
+            return false;
+        const Vec3 e = hi - lo;
+        const Real faces[3] = {e.y * e.z, e.z * e.x, e.x * e.y};
+        // u0 picks the axis by area, then which of its two faces.
+        Real t = u0 * (faces[0] + faces[1] + faces[2]);
+        int axis = 0;
+        while (axis < 2 && t >= faces[axis])
+            t -= faces[axis++];
+        const bool upper = faces[axis] > 0 && t >= faces[axis] / 2;
+
+        Vec3 q;
+        q[axis] = upper ? hi[axis] : lo[axis];
+        q[(axis + 1) % 3] = lo[(axis + 1) % 3] + u1 * e[(axis + 1) % 3];
+        q[(axis + 2) % 3] = lo[(axis + 2) % 3] + u2 * e[(axis + 2) % 3];
+
+        const Vec3 d = q - p;
+        const Real dist2 = d.length_squared();
+        s.dist = std::sqrt(dist2);
+        if (s.dist <= 0)
+            return false;
+        s.dir = d / s.dist;
+        const Real cos_light = std::fabs(s.dir[axis]);
+        if (cos_light <= 0)
+            return false;
+        s.pdf = dist2 / (cos_light * area);
+        return true;
+    }
+
+    Real pdf(const Vec3 &p, const Vec3 &dir, const HitRecord &rec) const
+    {
+        const Real len = dir.length();
+        const Real dist = rec.t * len;
+        const Real cos_light = std::fabs(dot(rec.normal, dir)) / len;
+        return dist * dist / (cos_light * area);
+    }
+};
+
+// Light class. An emitting primitive that diffuse surfaces sample directly:
+// a copy of its shape and the radiance it emits.
+class Light
+{
+public:
+    using Shape = std::variant<SphereLight, PlaneLight, BoxLight>;
+    Shape shape;
+    Vec3 radiance;
+
+    template <typename S>
+    Light(const S &s, const Vec3 &r) : shape(s), radiance(r) {}
+
+    // Tag of light shape S, as shape.index() reports it.
+    template <typename S>
+    static constexpr std::size_t index_of()
+    {
+        return VariantIndex<S, Shape>::value;
+    }
+
+    // Sample a direction from p towards the light. u0 is spent on choosing
+    // part of the light, u1 and u2 on the direction or point within it.
+    bool sample(const Vec3 &p, Real u0, Real u1, Real u2, LightSample &s) const
+    {
+        switch (shape.index())
+        {
+        case index_of<SphereLight>():
+            return std::get<SphereLight>(shape).sample(p, u0, u1, u2, s);
+        case index_of<PlaneLight>():
+            return std::get<PlaneLight>(shape).sample(p, u0, u1, u2, s);
+        default:
+            return std::get<BoxLight>(shape).sample(p, u0, u1, u2, s);
+        }
+    }
+
+    // Solid angle density with which sample() picks the direction dir from
+    // p, given the light's hit record along it.
+    Real pdf(const Vec3 &p, const Vec3 &dir, const HitRecord &rec) const
+    {
+        switch (shape.index())
+        {
+        case index_of<SphereLight>():
+            return std::get<SphereLight>(shape).pdf(p, dir, rec);
+        case index_of<PlaneLight>():
+            return std::get<PlaneLight>(shape).pdf(p, dir, rec);
+        default:
+            return std::get<BoxLight>(shape).pdf(p, dir, rec);
+        }
+    }
+};
+
+#endif
@@ -3,37 +3,32 @@
 
 #include "HitRecord.hpp"
 #include "Ray.hpp"
+#include "Sampler.hpp"
 #include "Texture.hpp"
 #include "Vec3.hpp"
 #include "utils.hpp"
 
 #include <cmath>
-
-// Base material class.
-class Material
-{
-public:
-    virtual ~Material() = default;
-    virtual bool scatter(const Ray &r_in, const HitRecord &rec, Ray &scattered, Vec3 &attenuation) const = 0;
-};
+#include <cstddef>
+#include <variant>
 
 // Dielectric material class.
-class Dielectric final : public Material
+class Dielectric final
 {
 public:
-    double ref_idx;
-    Dielectric(double ri) : ref_idx(ri) {}
+    Real ref_idx;
+    Dielectric(Real ri) : ref_idx(ri) {}
 
-    bool scatter(const Ray &r_in, const HitRecord &rec, Ray &scattered, Vec3 &attenuation) const override
+    bool scatter(const Ray &r_in, const HitRecord &rec, Ray &scattered, Vec3 &attenuation, Sampler &sampler) const
     {
 
         attenuation = Vec3(1.0, 1.0, 1.0);
 
-        const double eta = rec.front ? (1.0 / ref_idx) : ref_idx;
+        const Real eta = rec.front ? (1.0 / ref_idx) : ref_idx;
 
         const Vec3 unit_dir = normalize(r_in.dir);
-        const double cos_theta = fmin(dot(-unit_dir, rec.normal), 1.0);
-        const double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+        const Real cos_theta = std::fmin(dot(-unit_dir, rec.normal), Real(1));
+        const Real sin_theta = std::sqrt(1 - cos_theta * cos_theta);
 
         // Reflection.
         if (eta * sin_theta > 1.0)
@@ -45,10 +40,10 @@ public:
         }
 
         // Refraction and Schlick's approximation.
-        double r0 = (1 - eta) / (1 + eta);
+        Real r0 = (1 - eta) / (1 + eta);
         r0 *= r0;
-        const double reflect_prob = r0 + (1 - r0) * pow(1 - cos_theta, 5);
-        if (RandDouble() < reflect_prob)
+        const Real reflect_prob = r0 + (1 - r0) * std::pow(1 - cos_theta, 5);
+        if (sampler.next_1d() < reflect_prob)
         {
             const Vec3 reflected = unit_dir - 2 * dot(unit_dir, rec.normal) * rec.normal;
             scattered = Ray(rec.p, reflected);
@@ -58,7 +53,7 @@ public:
 
         Vec3 refracted_parallel = eta * (unit_dir + cos_theta * rec.normal);
         Vec3 refracted_perp =
-            -sqrt(1.0 - refracted_parallel.length_squared()) * rec.normal;
+            -std::sqrt(1 - refracted_parallel.length_squared()) * rec.normal;
         Vec3 refracted = refracted_parallel + refracted_perp;
         scattered = Ray(rec.p, refracted);
 
@@ -67,41 +62,143 @@ public:
 };
 
 // Diffuse material class.
-class Lambertian final : public Material
+class Lambertian final
 {
 public:
-    Texture *albedo;
-    Lambertian(Texture *t) : albedo(t) {}
+    // Index of the albedo texture in the TextureTable.
+    int albedo;
+    Lambertian(int t) : albedo(t) {}
 
-    bool scatter(const Ray &r_in, const HitRecord &rec, Ray &scattered, Vec3 &attenuation) const override
+    bool scatter(const Ray &r_in, const HitRecord &rec, Ray &scattered, Vec3 &attenuation, Sampler &sampler,
+                 const TextureTable &textures) const
     {
 
-        const Vec3 target = rec.p + rec.normal + RandUnitVec();
+        double u1, u2;
+        sampler.next_2d(u1, u2);
+        const Vec3 target = rec.p + rec.normal + SampleUnitVec(u1, u2);
         scattered = Ray(rec.p, target - rec.p);
-        attenuation = albedo->value(rec.u, rec.v, rec.p);
+        attenuation = textures.value(albedo, rec.u, rec.v, rec.p, rec.du, rec.dv);
 
         return true;
     }
 };
 
 // Metal material class.
-class Metal final : public Material
+class Metal final
 {
 public:
-    double fuzz;
+    Real fuzz;
     Vec3 albedo;
-    Metal(const Vec3 &a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+    Metal(const Vec3 &a, Real f) : fuzz(f < 1 ? f : 1), albedo(a) {}
 
-    bool scatter(const Ray &r_in, const HitRecord &rec, Ray &scattered, Vec3 &attenuation) const override
+    bool scatter(const Ray &r_in, const HitRecord &rec, Ray &scattered, Vec3 &attenuation, Sampler &sampler) const
     {
 
         const Vec3 unit_dir = normalize(r_in.dir);
         const Vec3 reflected = unit_dir - 2 * dot(unit_dir, rec.normal) * rec.normal;
-        scattered = Ray(rec.p, reflected + fuzz * RandVecInUnitSphere());
+        double u1, u2;
+        sampler.next_2d(u1, u2);
+        const double u3 = sampler.next_1d();
+        scattered = Ray(rec.p, reflected + fuzz * SampleInUnitSphere(u1, u2, u3));
         attenuation = albedo;
 
         return dot(scattered.dir, rec.normal) > 0;
     }
 };
 
+// Emissive material class. Emits its radiance, tinted by the primitive's
+// colour, and reflects nothing.
+class Emissive final
+{
+public:
+    Vec3 radiance;
+    Emissive(const Vec3 &r) : radiance(r) {}
+
+    bool scatter(const Ray &r_in, const HitRecord &rec, Ray &scattered, Vec3 &attenuation, Sampler &sampler) const
+    {
+        return false;
+    }
+};
+
+// Material record: one of the material kinds, tagged. Scatter dispatches
+// with a switch on the tag, so each kind's scatter() can be inlined into
+// the bounce loop.
+class Material
+{
+public:
+    using Kind = std::variant<Lambertian, Metal, Dielectric, Emissive>;
+    Kind kind;
+
+    Material(const Lambertian &m) : kind(m) {}
+    Material(const Metal &m) : kind(m) {}
+    Material(const Dielectric &m) : kind(m) {}
+    Material(const Emissive &m) : kind(m) {}
+
+    // Tag of material kind K, as kind.index() reports it.
+    template <typename K>
+    static constexpr std::size_t index_of()
+    {
+        return VariantIndex<K, Kind>::value;
+    }
+
+    // Diffuse surfaces are the ones lights are sampled from.
+    bool diffuse() const { return kind.index() == index_of<Lambertian>(); }
+    bool emits() const { return kind.index() == index_of<Emissive>(); }
+
+    // Radiance emitted, before the primitive's colour.
+    Vec3 emitted() const
+    {
+        return emits() ? std::get<Emissive>(kind).radiance : Vec3();
+    }
+
+    bool scatter(const Ray &r_in, const HitRecord &rec, Ray &scattered, Vec3 &attenuation, Sampler &sampler,
+                 const TextureTable &textures) const
+    {
+        switch (kind.index())
+        {
+        case index_of<Lambertian>():
+            return std::get<Lambertian>(kind).scatter(r_in, rec, scattered, attenuation, sampler, textures);
+        case index_of<Metal>():
+            return std::get<Metal>(kind).scatter(r_in, rec, scattered, attenuation, sampler);
+        case index_of<Dielectric>():
+            return std::get<Dielectric>(kind).scatter(r_in, rec, scattered, attenuation, sampler);
+        default:
+            return std::get<Emissive>(kind).scatter(r_in, rec, scattered, attenuation, sampler);
+        }
+    }
+
+    // Colour the material reflects at a hit, without sampling: the texture
+    // of a diffuse surface, the tint of a metal and white for glass. For a
+    // light it is the radiance it emits.
+    Vec3 albedo(const HitRecord &rec, const TextureTable &textures) const
+    {
+        switch (kind.index())
+        {
+        case index_of<Lambertian>():
+            return textures.value(std::get<Lambertian>(kind).albedo, rec.u, rec.v, rec.p, rec.du, rec.dv);
+        case index_of<Metal>():
+            return std::get<Metal>(kind).albedo;
+        case index_of<Dielectric>():
+            return Vec3(1, 1, 1);
+        default:
+            return std::get<Emissive>(kind).radiance;
+        }
+    }
+
+    // Angle by which a bounce widens the ray cone. A diffuse bounce gets a
+    // fixed wide cone: what it sees is averaged over the hemisphere anyway.
+    Real spread() const
+    {
+        switch (kind.index())
+        {
+        case index_of<Lambertian>():
+            return 0.25;
+        case index_of<Metal>():
+            return std::get<Metal>(kind).fuzz;
+        default:
+            return 0.0;
+        }
+    }
+};
+
 #endif
\ No newline at end of file
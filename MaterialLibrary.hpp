@@ -0,0 +1,97 @@
+#ifndef MATERIALLIBRARY_HEADER_H
+#define MATERIALLIBRARY_HEADER_H
+
+#include "Material.hpp"
+#include "Texture.hpp"
+#include "Vec3.hpp"
+
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Every material and texture of a scene, stored as tagged records in two
+// contiguous tables and referred to by index. The factory functions intern
+// their arguments, so asking twice for the same material or texture returns
+// the same index, and a record is only built the first time it is asked for.
+class MaterialLibrary
+{
+private:
+    std::unordered_map<std::string, int> interned;
+    size_t requests = 0;
+
+    // Index of the record interned under key, calling make() to build it
+    // if there is none yet.
+    template <typename Table, typename Make>
+    int create(const std::string &key, Table &table, Make make)
+    {
+        requests++;
+        auto it = interned.find(key);
+        if (it != interned.end())
+            return it->second;
+
+        table.emplace_back(make());
+        const int index = static_cast<int>(table.size()) - 1;
+        interned.emplace(key, index);
+        return index;
+    }
+
+    static std::string key(const char *type, const Vec3 &v, double s = 0.0)
+    {
+        char buf[160];
+        snprintf(buf, sizeof(buf), "%s %.17g %.17g %.17g %.17g", type, v.x, v.y, v.z, s);
+        return buf;
+    }
+
+    static std::string key(const char *type, int a, int b = -1)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%s %d %d", type, a, b);
+        return buf;
+    }
+
+public:
+    TextureTable textures;
+    std::vector<Material> materials;
+
+    int constant(const Vec3 &color)
+    {
+        return create(key("constant", color), textures.textures, [&] { return ConstantTexture(color); });
+    }
+
+    int checker(int even, int odd)
+    {
+        return create(key("checker", even, odd), textures.textures, [&] { return CheckerTexture(even, odd); });
+    }
+
+    int image(const std::string &filename)
+    {
+        return create("image " + filename, textures.textures, [&] { return ImageTexture(filename.c_str()); });
+    }
+
+    int lambertian(int albedo)
+    {
+        return create(key("lambertian", albedo), materials, [&] { return Lambertian(albedo); });
+    }
+
+    int metal(const Vec3 &albedo, double fuzz)
+    {
+        return create(key("metal", albedo, fuzz), materials, [&] { return Metal(albedo, fuzz); });
+    }
+
+    int dielectric(double ref_idx)
+    {
+        return create(key("dielectric", Vec3(), ref_idx), materials, [&] { return Dielectric(ref_idx); });
+    }
+
+    int emissive(const Vec3 &radiance)
+    {
+        return create(key("emissive", radiance), materials, [&] { return Emissive(radiance); });
+    }
+
+    // Distinct records held, and how many factory calls they served.
+    size_t record_count() const { return textures.textures.size() + materials.size(); }
+    size_t request_count() const { return requests; }
+};
+
+#endif
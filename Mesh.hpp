@@ -0,0 +1,271 @@
+#ifndef MESH_HEADER_H
+#define MESH_HEADER_H
+
+#include "BVH.hpp"
+#include "HitRecord.hpp"
+#include "Primitive.hpp"
+#include "Ray.hpp"
+#include "RenderStats.hpp"
+#include "Vec3.hpp"
+
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+// Mesh class. An indexed triangle mesh: vertex positions shared between
+// triangles, and optionally vertex normals and texture coordinates, each
+// with indices of their own as in an OBJ file. The triangles sit in a
+// hierarchy of their own, and a hit names the triangle as well as the
+// mesh, so the tests take and give its index:
+//
+//   int intersect(const Ray &ray, Real tmin, Real &tmax) const
+//   void interact(const Ray &ray, Real t, int triangle, HitRecord &rec) const
+//
+// Triangles face the side from which their corners run counterclockwise.
+class Mesh : public Primitive
+{
+private:
+    // The ray sheared and scaled so that it runs along +z from the origin,
+    // as in "Watertight Ray/Triangle Intersection" (Woop, Benthin and Wald,
+    // 2013). Triangles are tested against it in two dimensions, where an
+    // edge shared by two triangles gives the same edge function in both,
+    // so no ray slips between them.
+    struct ShearedRay
+    {
+        int kx, ky, kz;
+        Real sx, sy, sz;
+
+        explicit ShearedRay(const Ray &ray)
+        {
+            const Real ax = std::fabs(ray.dir.x), ay = std::fabs(ray.dir.y), az = std::fabs(ray.dir.z);
+            kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+            kx = (kz + 1) % 3;
+            ky = (kx + 1) % 3;
+            // Keep the winding when the ray runs down its main axis.
+            if (ray.dir[kz] < 0)
+                std::swap(kx, ky);
+            sx = ray.dir[kx] / ray.dir[kz];
+            sy = ray.dir[ky] / ray.dir[kz];
+            sz = 1 / ray.dir[kz];
+        }
+    };
+
+    // Test triangle i for a hit within [tmin, tmax], lowering tmax to it.
+    // If bary is given it receives the barycentric weights of the corners.
+    bool test(const Ray &ray, const ShearedRay &s, int i, Real tmin, Real &tmax, Real *bary = NULL) const
+    {
+        const Vec3 a = positions[indices[3 * i]] - ray.orig;
+        const Vec3 b = positions[indices[3 * i + 1]] - ray.orig;
+        const Vec3 c = positions[indices[3 * i + 2]] - ray.orig;
+        const Real ax = a[s.kx] - s.sx * a[s.kz], ay = a[s.ky] - s.sy * a[s.kz];
+        const Real bx = b[s.kx] - s.sx * b[s.kz], by = b[s.ky] - s.sy * b[s.kz];
+        const Real cx = c[s.kx] - s.sx * c[s.kz], cy = c[s.ky] - s.sy * c[s.kz];
+
+        // Edge functions: each is the weight of the corner opposite its edge.
+        Real u = cx * by - cy * bx;
+        Real v = ax * cy - ay * cx;
+        Real w = bx * ay - by * ax;
+        // A ray through an edge in float is decided again in double.
+        if constexpr (std::is_same<Real, float>::value)
+        {
+            if (u == 0 || v == 0 || w == 0)
+            {
+                u = static_cast<Real>(static_cast<double>(cx) * by - static_cast<double>(cy) * bx);
+                v = static_cast<Real>(static_cast<double>(ax) * cy - static_cast<double>(ay) * cx);
+                w = static_cast<Real>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+            }
+        }
+        if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+            return false;
+        const Real det = u + v + w;
+        if (det == 0)
+            return false;
+
+        const Real t = (u * s.sz * a[s.kz] + v * s.sz * b[s.kz] + w * s.sz * c[s.kz]) / det;
+        if (!(t >= tmin && t <= tmax))
+            return false;
+        tmax = t;
+        if (bary)
+        {
+            bary[0] = u / det;
+            bary[1] = v / det;
+            bary[2] = w / det;
+        }
+        return true;
+    }
+
+public:
+    std::vector<Vec3> positions;
+    std::vector<Vec3> normals;
+    // Texture coordinates, u then v.
+    std::vector<Real> uvs;
+    // Three indices per triangle into positions, and into normals and uvs
+    // unless those indices are empty; -1 for a corner without one.
+    std::vector<int> indices;
+    std::vector<int> normal_indices;
+    std::vector<int> uv_indices;
+    BVH bvh;
+
+    Mesh() {}
+    Mesh(Vec3 col, int m) : Primitive(col, m) {}
+
+    int triangles() const { return static_cast<int>(indices.size() / 3); }
+
+    // Slack of the box tests around triangles (see AABB::hit()). Each exit
+    // distance takes three roundings, bounded as in "Physically Based
+    // Rendering" (Pharr, Jakob and Humphreys).
+    static Real box_slack()
+    {
+        const Real eps = std::numeric_limits<Real>::epsilon() / 2;
+        return 1 + 2 * (3 * eps / (1 - 3 * eps));
+    }
+
+    // Bounding box of the mesh.
+    AABB bounds() const
+    {
+        AABB box;
+        for (const Vec3 &p : positions)
+            box.grow(p);
+        return box;
+    }
+
+    // Scale the mesh about its origin and move it by offset.
+    void place(const Vec3 &offset, Real scale)
+    {
+        for (Vec3 &p : positions)
+            p = scale * p + offset;
+    }
+
+    // Build the hierarchy and reorder the triangles into its leaf order.
+    // Triangles are tested one at a time, which costs about as much as a
+    // traversal step, so leaves are kept small.
+    void build()
+    {
+        const int n = triangles();
+        std::vector<AABB> boxes(n);
+        for (int i = 0; i < n; i++)
+        {
+            boxes[i].grow(positions[indices[3 * i]]);
+            boxes[i].grow(positions[indices[3 * i + 1]]);
+            boxes[i].grow(positions[indices[3 * i + 2]]);
+        }
+        bvh.intersect_cost = 1.0;
+        bvh.max_leaf_size = 4;
+        bvh.slack = box_slack();
+        std::vector<int> order;
+        bvh.build(boxes, order);
+        boxes = std::vector<AABB>();
+
+        auto reorder = [&](std::vector<int> &corners) {
+            if (corners.empty())
+                return;
+            std::vector<int> sorted(corners.size());
+            for (int i = 0; i < n; i++)
+                for (int k = 0; k < 3; k++)
+                    sorted[3 * i + k] = corners[3 * order[i] + k];
+            corners.swap(sorted);
+        };
+        reorder(indices);
+        reorder(normal_indices);
+        reorder(uv_indices);
+    }
+
+    // Nearest triangle hit within [tmin, tmax], or -1. Its distance is
+    // stored in tmax.
+    int intersect(const Ray &ray, Real tmin, Real &tmax) const
+    {
+        const ShearedRay s(ray);
+        int closest = -1;
+        bvh.traverse(ray, tmin, tmax, [&](int first, int count, Real &t) {
+            RT_STAT(ThreadCounters.leaf_visits++);
+            RT_STAT(ThreadCounters.triangle_tests += count);
+            const int before = closest;
+            for (int i = first; i < first + count; i++)
+            {
+                if (test(ray, s, i, tmin, t))
+                    closest = i;
+            }
+            return closest != before;
+        });
+        return closest;
+    }
+
+    // Whether any triangle lies along the ray within [tmin, tmax].
+    bool occluded(const Ray &ray, Real tmin, Real tmax) const
+    {
+        const ShearedRay s(ray);
+        return bvh.traverse_any(ray, tmin, tmax, [&](int first, int count) {
+            RT_STAT(ThreadCounters.leaf_visits++);
+            RT_STAT(ThreadCounters.triangle_tests += count);
+            for (int i = first; i < first + count; i++)
+            {
+                Real t = tmax;
+                if (test(ray, s, i, tmin, t))
+                    return true;
+            }
+            return false;
+        });
+    }
+
+    // Store the hit point, hit distance, normal, front face and texture
+    // coordinates of the hit on the triangle at distance t in the hit
+    // record. The triangle is tested again for the barycentric weights,
+    // which blend the corners' normals and texture coordinates; a mesh
+    // without them gets the face normal and the weights of the second and
+    // third corners as coordinates.
+    void interact(const Ray &ray, Real t, int triangle, HitRecord &rec) const
+    {
+        Real w[3] = {Real(1) / 3, Real(1) / 3, Real(1) / 3};
+        Real tmax = INFINITY;
+        test(ray, ShearedRay(ray), triangle, -INFINITY, tmax, w);
+
+        const int *corner = &indices[3 * triangle];
+        const Vec3 e1 = positions[corner[1]] - positions[corner[0]];
+        const Vec3 e2 = positions[corner[2]] - positions[corner[0]];
+        const Vec3 face = cross(e1, e2);
+
+        rec.t = t;
+        rec.p = ray.at(t);
+        rec.front = dot(ray.dir, face) < 0;
+        Vec3 n = face;
+        const int *nc = normal_indices.empty() ? NULL : &normal_indices[3 * triangle];
+        if (nc && nc[0] >= 0 && nc[1] >= 0 && nc[2] >= 0)
+        {
+            const Vec3 blend = w[0] * normals[nc[0]] + w[1] * normals[nc[1]] + w[2] * normals[nc[2]];
+            if (blend.length_squared() > 0)
+                n = blend;
+        }
+        n = normalize(n);
+        rec.normal = rec.front ? n : -n;
+
+        Real uv[3][2] = {{0, 0}, {1, 0}, {0, 1}};
+        const int *tc = uv_indices.empty() ? NULL : &uv_indices[3 * triangle];
+        if (tc && tc[0] >= 0 && tc[1] >= 0 && tc[2] >= 0)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                uv[k][0] = uvs[2 * tc[k]];
+                uv[k][1] = uvs[2 * tc[k] + 1];
+            }
+        }
+        // Coordinates outside [0, 1] repeat the texture.
+        const Real u = w[0] * uv[0][0] + w[1] * uv[1][0] + w[2] * uv[2][0];
+        const Real v = w[0] * uv[0][1] + w[1] * uv[1][1] + w[2] * uv[2][1];
+        rec.u = u - std::floor(u);
+        rec.v = v - std::floor(v);
+
+        // The footprint scales into texture space by the square root of the
+        // triangle's area there over its area in the scene.
+        const Real uv_area = std::fabs((uv[1][0] - uv[0][0]) * (uv[2][1] - uv[0][1]) -
+                                       (uv[2][0] - uv[0][0]) * (uv[1][1] - uv[0][1]));
+        const Real area = face.length();
+        const Real texels = area > 0 ? std::sqrt(uv_area / area) : 0;
+        rec.width = ray.width + ray.spread * t * ray.dir.length();
+        rec.du = rec.width * texels;
+        rec.dv = rec.width * texels;
+        rec.curvature = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef OBJLOADER_HEADER_H
+#define OBJLOADER_HEADER_H
+
+#include "Mesh.hpp"
+#include "Vec3.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Parser over a memory-mapped OBJ file. It reads the file in place, a
+// statement at a time, and allocates nothing but the mesh's own arrays.
+class ObjParser
+{
+private:
+    const char *p;
+    const char *end;
+    const char *filename;
+    int lineno = 1;
+
+    void skip_blanks()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            p++;
+    }
+
+    // Move to the start of the next line.
+    void next_line()
+    {
+        while (p < end && *p != '\n')
+            p++;
+        if (p < end)
+        {
+            p++;
+            lineno++;
+        }
+    }
+
+    bool at_line_end() const { return p == end || *p == '\n' || *p == '#'; }
+
+    bool number(Real &value)
+    {
+        skip_blanks();
+        if (p < end && *p == '+')
+            p++;
+        double d;
+        const std::from_chars_result r = std::from_chars(p, end, d);
+        if (r.ec != std::errc())
+            return false;
+        p = r.ptr;
+        value = static_cast<Real>(d);
+        return true;
+    }
+
+    bool integer(int &value)
+    {
+        const bool negative = p < end && *p == '-';
+        if (negative)
+            p++;
+        if (p == end || *p < '0' || *p > '9')
+            return false;
+        long long n = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            if (n < (1LL << 31))
+                n = 10 * n + (*p - '0');
+        }
+        if (n >= (1LL << 31))
+            return false;
+        value = static_cast<int>(negative ? -n : n);
+        return true;
+    }
+
+    // Turn a 1-based index, or a negative one counting back from the
+    // latest element, into a 0-based one. Returns -1 if out of range.
+    static int resolve(int index, size_t count)
+    {
+        const long long i = index < 0 ? static_cast<long long>(count) + index : index - 1LL;
+        return i >= 0 && i < static_cast<long long>(count) ? static_cast<int>(i) : -1;
+    }
+
+    bool fail(const char *msg) const
+    {
+        fprintf(stderr, "ERROR: %s:%d: %s\n", filename, lineno, msg);
+        return false;
+    }
+
+    // One corner of a face: v, v/vt, v//vn or v/vt/vn.
+    bool corner(const Mesh &mesh, int &v, int &vt, int &vn)
+    {
+        vt = vn = -1;
+        if (!integer(v) || (v = resolve(v, mesh.positions.size())) < 0)
+            return false;
+        if (p == end || *p != '/')
+            return true;
+        p++;
+        if (p < end && *p != '/' && (!integer(vt) || (vt = resolve(vt, mesh.uvs.size() / 2)) < 0))
+            return false;
+        if (p == end || *p != '/')
+            return true;
+        p++;
+        return integer(vn) && (vn = resolve(vn, mesh.normals.size())) >= 0;
+    }
+
+    // A face, split into a fan of triangles around its first corner.
+    bool face(Mesh &mesh, bool &has_normals, bool &has_uvs)
+    {
+        int first[3], prev[3], cur[3];
+        int corners = 0;
+        while (true)
+        {
+            skip_blanks();
+            if (at_line_end())
+                break;
+            if (!corner(mesh, cur[0], cur[1], cur[2]))
+                return fail("bad or out of range vertex index in face");
+            if (corners == 0)
+                std::copy(cur, cur + 3, first);
+            else if (corners >= 2)
+            {
+                mesh.indices.insert(mesh.indices.end(), {first[0], prev[0], cur[0]});
+                mesh.uv_indices.insert(mesh.uv_indices.end(), {first[1], prev[1], cur[1]});
+                mesh.normal_indices.insert(mesh.normal_indices.end(), {first[2], prev[2], cur[2]});
+                has_uvs |= first[1] >= 0 || prev[1] >= 0 || cur[1] >= 0;
+                has_normals |= first[2] >= 0 || prev[2] >= 0 || cur[2] >= 0;
+            }
+            std::copy(cur, cur + 3, prev);
+            corners++;
+        }
+        if (corners < 3)
+            return fail("a face needs at least three corners");
+        return true;
+    }
+
+public:
+    ObjParser(const char *data, size_t size, const char *name) : p(data), end(data + size), filename(name) {}
+
+    // Read the vertex positions (v), texture coordinates (vt), normals (vn)
+    // and faces (f). Other statements, such as groups and materials, are
+    // skipped.
+    bool parse(Mesh &mesh)
+    {
+        bool has_normals = false, has_uvs = false;
+        while (p < end)
+        {
+            skip_blanks();
+            if (end - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                p++;
+                Vec3 v;
+                if (!number(v.x) || !number(v.y) || !number(v.z))
+                    return fail("expected 'v <x> <y> <z>'");
+                mesh.positions.push_back(v);
+            }
+            else if (end - p >= 3 && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t'))
+            {
+                p += 2;
+                Vec3 n;
+                if (!number(n.x) || !number(n.y) || !number(n.z))
+                    return fail("expected 'vn <x> <y> <z>'");
+                mesh.normals.push_back(n);
+            }
+            else if (end - p >= 3 && p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t'))
+            {
+                p += 2;
+                Real u, v = 0;
+                if (!number(u))
+                    return fail("expected 'vt <u> [v]'");
+                skip_blanks();
+                if (!at_line_end() && !number(v))
+                    return fail("expected 'vt <u> [v]'");
+                mesh.uvs.push_back(u);
+                mesh.uvs.push_back(v);
+            }
+            else if (end - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                p++;
+                if (!face(mesh, has_normals, has_uvs))
+                    return false;
+            }
+            next_line();
+        }
+
+        if (mesh.indices.empty())
+            return fail("no faces");
+        if (!has_normals)
+            std::vector<int>().swap(mesh.normal_indices);
+        if (!has_uvs)
+            std::vector<int>().swap(mesh.uv_indices);
+        mesh.positions.shrink_to_fit();
+        mesh.normals.shrink_to_fit();
+        mesh.uvs.shrink_to_fit();
+        mesh.indices.shrink_to_fit();
+        mesh.normal_indices.shrink_to_fit();
+        mesh.uv_indices.shrink_to_fit();
+        return true;
+    }
+};
+
+// Load the triangles of a Wavefront OBJ file into mesh. The file is mapped
+// into memory rather than read, and polygons are split into triangles.
+inline bool LoadObj(const char *filename, Mesh &mesh)
+{
+    const int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        fprintf(stderr, "ERROR: Could not open mesh file '%s'.\n", filename);
+        return false;
+    }
+    // An empty file cannot be mapped, and has no faces either.
+    const size_t size = st.st_size;
+    void *data = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "ERROR: Could not map mesh file '%s'.\n", filename);
+        return false;
+    }
+    if (data)
+        madvise(data, size, MADV_SEQUENTIAL);
+
+    const bool ok = ObjParser(static_cast<const char *>(data), size, filename).parse(mesh);
+    if (data)
+        munmap(data, size);
+    return ok;
+};
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef PATHTRACER_HEADER_H
+#define PATHTRACER_HEADER_H
+
+#include "HitRecord.hpp"
+#include "Light.hpp"
+#include "Material.hpp"
+#include "Primitive.hpp"
+#include "Ray.hpp"
+#include "RenderStats.hpp"
+#include "Sampler.hpp"
+#include "Scene.hpp"
+#include "Vec3.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <variant>
+
+// Path termination settings.
+struct PathSettings
+{
+    int maxdepth = 50;
+    // Russian roulette starts after this many bounces...
+    int rr_depth = 3;
+    // ...on paths whose throughput has dropped below this value.
+    double rr_threshold = 0.1;
+    // Sample a light with a shadow ray at every diffuse bounce.
+    bool light_sampling = true;
+};
+
+// Per-worker path counters, merged once rendering is done.
+struct PathStats
+{
+    uint64_t paths = 0;
+    uint64_t segments = 0;
+    uint64_t roulette = 0;
+    uint64_t roulette_cut = 0;
+    uint64_t shadow_rays = 0;
+
+    void merge(const PathStats &other)
+    {
+        paths += other.paths;
+        segments += other.segments;
+        roulette += other.roulette;
+        roulette_cut += other.roulette_cut;
+        shadow_rays += other.shadow_rays;
+    }
+
+    void print(FILE *out) const
+    {
+        const double n = paths > 0 ? static_cast<double>(paths) : 1.0;
+        fprintf(out, "Paths: %llu, average length %.3f, ended by roulette %.2f%%, "
+                     "depth budget cut by roulette %.3f per path, %.3f shadow rays per path\n",
+                (unsigned long long)paths, segments / n, 100.0 * roulette / n, roulette_cut / n,
+                shadow_rays / n);
+    }
+};
+
+// What a camera ray hits first, for the auxiliary buffers the denoiser is
+// guided by. A ray that escapes leaves it zero.
+struct FirstHit
+{
+    // Material albedo times the primitive's colour; what a light emits.
+    Vec3 albedo;
+    // Shading normal, facing the ray.
+    Vec3 normal;
+    // Distance along the ray.
+    Real depth = 0;
+
+    void record(const Ray &ray, const Primitive &hit, const HitRecord &rec, const MaterialLibrary &library)
+    {
+        albedo = library.materials[hit.material].albedo(rec, library.textures) * hit.color;
+        normal = rec.normal;
+        depth = rec.t * ray.dir.length();
+    }
+};
+
+// Light reaching a diffuse hit straight from a light, estimated with one
+// shadow ray towards a light picked uniformly at random. reflectance is
+// the surface's albedo times its colour. The two ways a path can find a
+// light, this and the bounce ray running into it, are combined with the
+// power heuristic (multiple importance sampling): each is weighted by its
+// share of the squared densities, so whichever samples a light better
+// dominates, and EmissionWeight() weights the bounce's share.
+inline Vec3 SampleLight(const Scene &scene, const HitRecord &rec, const Vec3 &reflectance, Sampler &sampler,
+                        PathStats &stats)
+{
+    const double u0 = sampler.next_1d();
+    double u1, u2;
+    sampler.next_2d(u1, u2);
+    const int n = static_cast<int>(scene.lights.size());
+    if (n == 0)
+        return Vec3();
+    const int k = std::min(static_cast<int>(u0 * n), n - 1);
+    const Light &light = scene.lights[k];
+    LightSample s;
+    if (!light.sample(rec.p, u0 * n - k, u1, u2, s))
+        return Vec3();
+    const Real cosine = dot(s.dir, rec.normal);
+    if (cosine <= 0 || !(s.pdf > 0))
+        return Vec3();
+
+    stats.shadow_rays++;
+    RT_STAT(ThreadCounters.shadow_rays++);
+    if (scene.occluded(Ray(rec.p, s.dir), 0.001, s.dist - 0.001))
+        return Vec3();
+
+    const Real light_pdf = s.pdf / n;
+    const Real bsdf_pdf = cosine / pi;
+    const Real weight = light_pdf * light_pdf / (light_pdf * light_pdf + bsdf_pdf * bsdf_pdf);
+    return reflectance * light.radiance * (cosine / pi * weight / light_pdf);
+};
+
+// Weight of the emission a ray finds, the bounce's share of the multiple
+// importance sampling in SampleLight(). bsdf_pdf is the density with which
+// the bounce chose the ray; it is 0 for camera rays and bounces that
+// sampled no light, whose emission counts in full.
+inline Real EmissionWeight(const Scene &scene, const Primitive &hit, const Ray &ray, const HitRecord &rec,
+                           Real bsdf_pdf)
+{
+    if (bsdf_pdf <= 0 || hit.light < 0)
+        return 1;
+    const Real light_pdf = scene.lights[hit.light].pdf(ray.orig, ray.dir, rec) / scene.lights.size();
+    return bsdf_pdf * bsdf_pdf / (bsdf_pdf * bsdf_pdf + light_pdf * light_pdf);
+};
+
+// The scatter counters are indexed by material tag and named in this order
+// in RenderStats.hpp, and the wavefront integrator buckets paths by tag
+// with emitters last.
+static_assert(Material::index_of<Lambertian>() == 0 && Material::index_of<Metal>() == 1 &&
+                  Material::index_of<Dielectric>() == 2 && Material::index_of<Emissive>() == 3 &&
+                  std::variant_size<Material::Kind>::value == RenderCounters::material_kinds,
+              "material kinds reordered; update RenderStats.hpp and Wavefront.hpp");
+
+// Obtain the color of a ray by following its path iteratively. The running
+// throughput is the product of every attenuation so far; once it gets small
+// the path is continued with probability proportional to it and reweighted,
+// which keeps the estimate unbiased. Diffuse bounces also sample a light
+// directly (next-event estimation). Every bounce draws its numbers from
+// its own dimensions of the sampler. If first is given, the camera ray's
+// hit is recorded in it.
+inline Vec3 RayColor(Ray ray, const Scene &scene, const PathSettings &settings, Sampler &sampler, PathStats &stats,
+                     FirstHit *first = NULL)
+{
+    Vec3 radiance(0, 0, 0);
+    Vec3 throughput(1, 1, 1);
+    // Density of the current ray's direction, for weighting its emission.
+    Real bsdf_pdf = 0;
+    stats.paths++;
+
+    for (int depth = 0; depth < settings.maxdepth; depth++)
+    {
+        stats.segments++;
+        RT_STAT(depth == 0 ? ThreadCounters.primary_rays++ : ThreadCounters.secondary_rays++);
+
+        // Find the closest primitive along the ray.
+        HitRecord rec;
+        const Primitive *hit = scene.hit(ray, 0.001, INFINITY, rec);
+
+        // If not hit, return background color.
+        if (!hit)
+        {
+            RT_STAT(ThreadCounters.end_path(depth + 1, PathEnd::Escaped));
+            Vec3 unitvec = normalize(ray.dir);
+            const Real temp = 0.5 * ((unitvec.y) + 1.0);
+            return radiance + throughput * (temp * Vec3(0, 0, 0));
+        }
+        if (depth == 0 && first)
+            first->record(ray, *hit, rec, scene.library);
+
+        // Emitters end the path.
+        const MaterialLibrary &library = scene.library;
+        const Material &material = library.materials[hit->material];
+        if (material.emits())
+        {
+            RT_STAT(ThreadCounters.end_path(depth + 1, PathEnd::Emitted));
+            const Real weight = EmissionWeight(scene, *hit, ray, rec, bsdf_pdf);
+            return radiance + throughput * weight * material.emitted() * hit->color;
+        }
+
+        Ray scattered;
+        Vec3 attenuation;
+        RT_STAT(ThreadCounters.scatters[material.kind.index()]++);
+        sampler.start_bounce(depth);
+        if (!material.scatter(ray, rec, scattered, attenuation, sampler, library.textures))
+        {
+            RT_STAT(ThreadCounters.end_path(depth + 1, PathEnd::Absorbed));
+            return radiance;
+        }
+        // The cone leaves the surface as wide as it arrived; a convex
+        // surface bends its edges apart and rough materials widen it further.
+        scattered.width = rec.width;
+        scattered.spread = ray.spread + 2 * rec.width * rec.curvature + material.spread();
+        const Vec3 reflectance = attenuation * hit->color;
+        bsdf_pdf = 0;
+        if (settings.light_sampling && material.diffuse())
+        {
+            radiance += throughput * SampleLight(scene, rec, reflectance, sampler, stats);
+            // Diffuse bounces are cosine distributed.
+            bsdf_pdf = std::fmax(Real(0), dot(normalize(scattered.dir), rec.normal)) / pi;
+        }
+        throughput = throughput * reflectance;
+        ray = scattered;
+
+        // Russian roulette.
+        if (depth + 1 >= settings.rr_depth)
+        {
+            const Real p = std::fmax(throughput.x, std::fmax(throughput.y, throughput.z));
+            if (p < settings.rr_threshold)
+            {
+                const Real survive = p / settings.rr_threshold;
+                if (sampler.next_1d() >= survive)
+                {
+                    stats.roulette++;
+                    stats.roulette_cut += settings.maxdepth - depth - 1;
+                    RT_STAT(ThreadCounters.end_path(depth + 1, PathEnd::Roulette));
+                    return radiance;
+                }
+                throughput /= survive;
+            }
+        }
+    }
+    RT_STAT(ThreadCounters.end_path(settings.maxdepth, PathEnd::MaxDepth));
+    return radiance;
+};
+
+#endif
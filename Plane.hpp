@@ -0,0 +1,62 @@
+#ifndef PLANE_HEADER_H
+#define PLANE_HEADER_H
+
+#include "HitRecord.hpp"
+#include "Primitive.hpp"
+#include "Ray.hpp"
+#include "Vec3.hpp"
+
+// Plane class. An infinite plane perpendicular to one axis, at
+// p[axis] == offset. Its outward normal points along +axis.
+class Plane : public Primitive
+{
+public:
+    int axis;
+    Real offset;
+    Plane() {}
+    Plane(int a, Real o, Vec3 col, int m) : Primitive(col, m), axis(a), offset(o) {}
+
+    // Determine whether the ray hits the plane within [tmin, tmax], and
+    // if so lower tmax to the hit distance.
+    bool intersect(const Ray &ray, Real tmin, Real &tmax) const
+    {
+        const Real t = (offset - ray.orig[axis]) / ray.dir[axis];
+        // Rays parallel to the plane give an infinite or NaN distance.
+        if (!(t >= tmin && t <= tmax))
+            return false;
+        tmax = t;
+        return true;
+    }
+
+    // Store the hit point, hit distance, normal, front face and texture
+    // coordinates of the hit at distance t in the hit record.
+    void interact(const Ray &ray, Real t, HitRecord &rec) const
+    {
+        rec.t = t;
+        rec.p = ray.at(t);
+        // Put the point exactly on the plane, so solid textures do not see
+        // rounding noise across it.
+        rec.p[axis] = offset;
+        Vec3 out_N;
+        out_N[axis] = 1;
+        rec.front = ray.dir[axis] < 0;
+        rec.normal = rec.front ? out_N : -out_N;
+        GetFlatUV(rec.p, axis, rec.u, rec.v);
+        rec.width = ray.width + ray.spread * t * ray.dir.length();
+        rec.du = rec.width;
+        rec.dv = rec.width;
+        rec.curvature = 0;
+    }
+
+    // Determine whether the ray hits the plane, and store the hit point,
+    // hit distance, normal, and front face in the hit record.
+    bool hit(const Ray &ray, HitRecord &rec, Real tmin, Real tmax) const
+    {
+        if (!intersect(ray, tmin, tmax))
+            return false;
+        interact(ray, tmax, rec);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,313 @@
+#ifndef PREVIEW_HEADER_H
+#define PREVIEW_HEADER_H
+
+#include "ImageIO.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Publishes the current estimate of a render while it is still running,
+// to any of
+//
+//   a rolling image file   rewritten in full and renamed into place, so a
+//                          viewer never reads it half written
+//   a named pipe           one whole image per publish, skipped while no
+//                          reader has the pipe open
+//   a local HTTP endpoint  http://127.0.0.1:PORT/ shows a page that keeps
+//                          reloading /image.png, the latest image as PNG
+//
+// Images are encoded on the caller's thread (the render's main thread).
+// A pipe is written by a thread of its own, so a reader that is slow or
+// never reads holds up only that thread: a newer image replaces one still
+// waiting, and the render goes on. The HTTP server answers requests on a
+// thread of its own too.
+class Preview
+{
+private:
+    std::string file;
+    ImageFormat format = ImageFormat::PNG;
+    int listener = -1;
+    std::thread server;
+    std::atomic<bool> quit{false};
+    // Latest PNG served over HTTP, swapped whole so a request in progress
+    // keeps the image it started with.
+    std::mutex lock;
+    std::shared_ptr<const std::vector<unsigned char>> latest;
+    // Next image for the pipe writer, if it has not taken it yet.
+    std::thread pipe_writer;
+    std::mutex pipe_lock;
+    std::condition_variable pipe_ready;
+    std::shared_ptr<const std::vector<unsigned char>> pipe_image;
+
+    static bool SendAll(int fd, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            const ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    // Answer one request. Only the path of the request line is looked at.
+    void serve(int fd)
+    {
+        timeval timeout = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        char request[4096];
+        size_t size = 0;
+        while (size < sizeof(request) - 1)
+        {
+            const ssize_t n = recv(fd, request + size, sizeof(request) - 1 - size, 0);
+            if (n <= 0)
+                break;
+            size += n;
+            request[size] = '\0';
+            if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+                break;
+        }
+        request[size] = '\0';
+
+        char header[256];
+        if (strncmp(request, "GET / ", 6) == 0)
+        {
+            static const char page[] =
+                "<!DOCTYPE html><html><head><title>Render preview</title></head>"
+                "<body style=\"margin:0;background:#222\"><img id=\"i\" src=\"/image.png\" style=\"max-width:100%\">"
+                "<script>setInterval(function(){var n=new Image();n.onload=function(){"
+                "document.getElementById('i').src=n.src;};n.src='/image.png?'+Date.now();},1000);</script>"
+                "</body></html>";
+            const int n = snprintf(header, sizeof(header),
+                                   "HTTP/1.0 200 OK\r\nContent-Type: text/html\r\nContent-Length: %d\r\n"
+                                   "Connection: close\r\n\r\n",
+                                   (int)sizeof(page) - 1);
+            if (SendAll(fd, header, n))
+                SendAll(fd, page, sizeof(page) - 1);
+            return;
+        }
+
+        std::shared_ptr<const std::vector<unsigned char>> image;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            image = latest;
+        }
+        if (!image)
+        {
+            static const char busy[] = "HTTP/1.0 503 Service Unavailable\r\nRetry-After: 1\r\n"
+                                       "Content-Length: 0\r\nConnection: close\r\n\r\n";
+            SendAll(fd, busy, sizeof(busy) - 1);
+            return;
+        }
+        const int n = snprintf(header, sizeof(header),
+                               "HTTP/1.0 200 OK\r\nContent-Type: image/png\r\nContent-Length: %zu\r\n"
+                               "Cache-Control: no-store\r\nConnection: close\r\n\r\n",
+                               image->size());
+        if (SendAll(fd, header, n))
+            SendAll(fd, reinterpret_cast<const char *>(image->data()), image->size());
+    }
+
+    // Accept connections until asked to quit, one request at a time.
+    void run()
+    {
+        while (!quit.load(std::memory_order_relaxed))
+        {
+            pollfd p = {listener, POLLIN, 0};
+            if (poll(&p, 1, 200) <= 0)
+                continue;
+            const int fd = accept(listener, NULL, NULL);
+            if (fd < 0)
+                continue;
+            serve(fd);
+            close(fd);
+        }
+    }
+
+    // Write the image to the named pipe, if anyone is reading it. Opening
+    // without blocking fails straight away when there is no reader. The
+    // pipe stays non-blocking and a full pipe is waited on in short polls,
+    // so that once asked to quit the writer gives up on a reader that has
+    // stopped taking data.
+    bool write_pipe(const std::vector<unsigned char> &image) const
+    {
+        const int fd = open(file.c_str(), O_WRONLY | O_NONBLOCK);
+        if (fd < 0)
+            return errno == ENXIO;
+        const unsigned char *data = image.data();
+        size_t size = image.size();
+        while (size > 0)
+        {
+            const ssize_t n = write(fd, data, size);
+            if (n > 0)
+            {
+                data += n;
+                size -= n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN)
+            {
+                pollfd p = {fd, POLLOUT, 0};
+                if (poll(&p, 1, 200) == 0 && quit.load(std::memory_order_relaxed))
+                    break;
+                continue;
+            }
+            break;
+        }
+        close(fd);
+        return size == 0;
+    }
+
+    // Write every image handed over to the pipe, skipping those replaced
+    // before their turn, until asked to quit with none left.
+    void run_pipe()
+    {
+        while (true)
+        {
+            std::shared_ptr<const std::vector<unsigned char>> image;
+            {
+                std::unique_lock<std::mutex> guard(pipe_lock);
+                pipe_ready.wait(guard, [this]() { return pipe_image || quit.load(std::memory_order_relaxed); });
+                if (!pipe_image)
+                    return;
+                image = std::move(pipe_image);
+            }
+            if (!write_pipe(*image))
+                fprintf(stderr, "\nWARNING: Could not write the preview to '%s'.\n", file.c_str());
+        }
+    }
+
+    // Write the image next to the file and rename it into place.
+    bool write_file(const std::vector<unsigned char> &image) const
+    {
+        const std::string tmp = file + ".tmp";
+        FILE *f = fopen(tmp.c_str(), "wb");
+        if (f == NULL)
+            return false;
+        const bool ok = fwrite(image.data(), 1, image.size(), f) == image.size();
+        if (fclose(f) != 0 || !ok || rename(tmp.c_str(), file.c_str()) != 0)
+        {
+            unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+public:
+    Preview() = default;
+    Preview(const Preview &) = delete;
+    Preview &operator=(const Preview &) = delete;
+
+    ~Preview()
+    {
+        {
+            std::lock_guard<std::mutex> guard(pipe_lock);
+            quit = true;
+        }
+        pipe_ready.notify_one();
+        if (pipe_writer.joinable())
+            pipe_writer.join();
+        if (server.joinable())
+            server.join();
+        if (listener >= 0)
+            close(listener);
+    }
+
+    // Publish to filename, a regular file or a named pipe, in the format
+    // its extension names. A reader closing the pipe early must not kill
+    // the render, so SIGPIPE is ignored from here on.
+    void open_file(const char *filename)
+    {
+        file = filename;
+        format = ImageFormatFromName(filename);
+        signal(SIGPIPE, SIG_IGN);
+        struct stat st;
+        if (stat(file.c_str(), &st) == 0 && S_ISFIFO(st.st_mode))
+            pipe_writer = std::thread([this]() { run_pipe(); });
+    }
+
+    // Serve previews over HTTP on the loopback interface.
+    bool listen_http(int port)
+    {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (listener < 0)
+        {
+            fprintf(stderr, "ERROR: Could not create the preview socket.\n");
+            return false;
+        }
+        const int yes = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listener, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0 || listen(listener, 8) != 0)
+        {
+            fprintf(stderr, "ERROR: Could not listen on port %d for previews.\n", port);
+            close(listener);
+            listener = -1;
+            return false;
+        }
+        server = std::thread([this]() { run(); });
+        fprintf(stderr, "Preview: http://127.0.0.1:%d/\n", port);
+        return true;
+    }
+
+    bool enabled() const { return !file.empty() || listener >= 0; }
+
+    // Publish an RGB float image, three channels per pixel, top row first.
+    // Failures are reported but do not stop the render.
+    void publish(const float *rgb, int width, int height)
+    {
+        std::vector<unsigned char> image;
+        if (!file.empty())
+        {
+            image = EncodeImage(format, rgb, width, height);
+            if (pipe_writer.joinable())
+            {
+                auto next = std::make_shared<const std::vector<unsigned char>>(image);
+                {
+                    std::lock_guard<std::mutex> guard(pipe_lock);
+                    pipe_image = std::move(next);
+                }
+                pipe_ready.notify_one();
+            }
+            else if (!write_file(image))
+                fprintf(stderr, "\nWARNING: Could not write the preview to '%s'.\n", file.c_str());
+        }
+        if (listener >= 0)
+        {
+            if (file.empty() || format != ImageFormat::PNG)
+                image = EncodeImage(ImageFormat::PNG, rgb, width, height);
+            auto png = std::make_shared<const std::vector<unsigned char>>(std::move(image));
+            std::lock_guard<std::mutex> guard(lock);
+            latest = std::move(png);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef PRIMITIVE_HEADER_H
+#define PRIMITIVE_HEADER_H
+
+#include "Vec3.hpp"
+
+#include <cmath>
+
+// Primitive class. Holds what every kind of primitive shares, so the
+// integrators can shade a hit without knowing what was hit. Each primitive
+// derives from it and provides
+//
+//   bool intersect(const Ray &ray, Real tmin, Real &tmax) const
+//   void interact(const Ray &ray, Real t, HitRecord &rec) const
+//
+// The first is the lean test run on every candidate: whether the ray hits
+// within [tmin, tmax], lowering tmax to the hit's distance if so. The
+// second runs once, on the closest hit, and fills in the record, including
+// the surface curvature used to widen ray cones. hit() does both, and
+// bounded primitives also provide bounds().
+class Primitive
+{
+public:
+    Vec3 color;
+    // Index into the scene's material table.
+    int material = -1;
+    // Index into the scene's light list if the material emits, else -1.
+    int light = -1;
+    Primitive() {}
+    Primitive(Vec3 col, int m) : color(col), material(m) {}
+};
+
+// Texture coordinates on a flat, axis-aligned face: the hit point's two
+// other coordinates, wrapped so image textures repeat every unit.
+inline void GetFlatUV(const Vec3 &p, int axis, Real &u, Real &v)
+{
+    const Real a = p[(axis + 1) % 3];
+    const Real b = p[(axis + 2) % 3];
+    u = a - std::floor(a);
+    v = b - std::floor(b);
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef RANDOM_HEADER_H
+#define RANDOM_HEADER_H
+
+#include <cstdint>
+
+// SplitMix64 finalizer, used to spread seeds over the generator state.
+inline uint64_t SplitMix64(uint64_t &x)
+{
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+};
+
+// Random number generator (xoshiro256+). Each instance is an independent
+// stream, so it must be passed explicitly to whoever draws samples; there
+// is no hidden global state to contend on between threads.
+class Rng
+{
+private:
+    uint64_t s[4];
+
+    static uint64_t rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+public:
+    // Seed a stream from a key and a counter, e.g. (pixel index, sample index).
+    explicit Rng(uint64_t key = 0, uint64_t counter = 0)
+    {
+        uint64_t x = key * 0xd1b54a32d192ed03ULL ^ SplitMix64(counter);
+        for (int i = 0; i < 4; i++)
+            s[i] = SplitMix64(x);
+    }
+
+    uint64_t next()
+    {
+        const uint64_t result = s[0] + s[3];
+        const uint64_t t = s[1] << 17;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+
+        return result;
+    }
+
+    // Uniform double in [0, 1) built from the top 53 bits.
+    double next_double()
+    {
+        return (next() >> 11) * 0x1.0p-53;
+    }
+};
+
+#endif
@@ -9,13 +9,17 @@ class Ray
 public:
     Vec3 orig;
     Vec3 dir;
+    // Ray cone used to filter textures: the width of the beam at the origin
+    // and the angle by which it widens per unit distance travelled.
+    Real width = 0;
+    Real spread = 0;
     Ray() = default;
     Ray(const Vec3 &origin, const Vec3 &direction)
         : orig(origin), dir(direction)
     {
     }
 
-    Vec3 at(double t) const
+    Vec3 at(Real t) const
     {
         return orig + t * dir;
     }
@@ -0,0 +1,267 @@
+#ifndef RENDERSTATS_HEADER_H
+#define RENDERSTATS_HEADER_H
+
+#include "Adaptive.hpp"
+#include "TileScheduler.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Render instrumentation. Counting is compiled in only when RT_STATS is
+// defined (make STATS=1); otherwise RT_STAT() expands to nothing and the
+// hot paths are untouched.
+#ifdef RT_STATS
+#define RT_STAT(statement) statement
+#else
+#define RT_STAT(statement)
+#endif
+
+// How a path ended.
+enum class PathEnd
+{
+    Escaped,
+    Emitted,
+    Absorbed,
+    Roulette,
+    MaxDepth,
+    Count
+};
+
+// Event counters of one thread. Each worker counts into its own copy with
+// no synchronisation; the copies are merged once the render is done.
+struct RenderCounters
+{
+    static const int depth_bins = 64;
+    static const int material_kinds = 4;
+
+    uint64_t primary_rays = 0;
+    uint64_t secondary_rays = 0;
+    uint64_t shadow_rays = 0;
+    uint64_t leaf_visits = 0;
+    uint64_t sphere_tests = 0;
+    // Sphere tests that found a hit nearer than any before it.
+    uint64_t sphere_hits = 0;
+    uint64_t triangle_tests = 0;
+    // Scatter calls by material kind, in Material::kind order.
+    uint64_t scatters[material_kinds] = {};
+    uint64_t path_ends[static_cast<int>(PathEnd::Count)] = {};
+    // Paths by the number of segments traced; the last bin takes the rest.
+    uint64_t depth_histogram[depth_bins] = {};
+
+    void end_path(int segments, PathEnd how)
+    {
+        path_ends[static_cast<int>(how)]++;
+        depth_histogram[segments < depth_bins ? segments : depth_bins - 1]++;
+    }
+
+    void merge(const RenderCounters &other)
+    {
+        primary_rays += other.primary_rays;
+        secondary_rays += other.secondary_rays;
+        shadow_rays += other.shadow_rays;
+        leaf_visits += other.leaf_visits;
+        sphere_tests += other.sphere_tests;
+        sphere_hits += other.sphere_hits;
+        triangle_tests += other.triangle_tests;
+        for (int i = 0; i < material_kinds; i++)
+            scatters[i] += other.scatters[i];
+        for (int i = 0; i < static_cast<int>(PathEnd::Count); i++)
+            path_ends[i] += other.path_ends[i];
+        for (int i = 0; i < depth_bins; i++)
+            depth_histogram[i] += other.depth_histogram[i];
+    }
+};
+
+// Counters of the calling thread.
+inline thread_local RenderCounters ThreadCounters;
+
+// Wall time spent rendering one tile.
+struct TileCost
+{
+    Tile tile;
+    double seconds;
+};
+
+// Statistics of a whole render: the merged counters and every tile's cost.
+class RenderReport
+{
+private:
+    static const char *material_name(int kind)
+    {
+        static const char *names[RenderCounters::material_kinds] = {"lambertian", "metal", "dielectric",
+                                                                    "emissive"};
+        return names[kind];
+    }
+
+    static const char *end_name(int end)
+    {
+        static const char *names[static_cast<int>(PathEnd::Count)] = {"escaped", "emitted", "absorbed",
+                                                                      "roulette", "max_depth"};
+        return names[end];
+    }
+
+    // Number of histogram bins up to the last non-empty one.
+    int used_depth_bins() const
+    {
+        int n = RenderCounters::depth_bins;
+        while (n > 0 && counters.depth_histogram[n - 1] == 0)
+            n--;
+        return n;
+    }
+
+    // Total cost of every tile: a progressive render records a tile once
+    // per pass.
+    std::vector<TileCost> tile_totals() const
+    {
+        std::vector<TileCost> sorted = tiles;
+        std::sort(sorted.begin(), sorted.end(), [](const TileCost &a, const TileCost &b) {
+            return a.tile.y0 != b.tile.y0 ? a.tile.y0 < b.tile.y0 : a.tile.x0 < b.tile.x0;
+        });
+        std::vector<TileCost> totals;
+        for (const TileCost &t : sorted)
+        {
+            if (!totals.empty() && totals.back().tile.x0 == t.tile.x0 && totals.back().tile.y0 == t.tile.y0)
+                totals.back().seconds += t.seconds;
+            else
+                totals.push_back(t);
+        }
+        return totals;
+    }
+
+public:
+    RenderCounters counters;
+    std::vector<TileCost> tiles;
+    int threads = 0;
+    double seconds = 0.0;
+
+    void add(const RenderCounters &c, const std::vector<TileCost> &t)
+    {
+        counters.merge(c);
+        tiles.insert(tiles.end(), t.begin(), t.end());
+    }
+
+    void write_text(FILE *out) const
+    {
+        const RenderCounters &c = counters;
+        const uint64_t rays = c.primary_rays + c.secondary_rays + c.shadow_rays;
+        const double n = rays > 0 ? static_cast<double>(rays) : 1.0;
+        fprintf(out, "Render time: %.3f s on %d threads, %.0f rays/s\n", seconds, threads,
+                seconds > 0 ? rays / seconds : 0.0);
+        fprintf(out, "Rays: %llu primary, %llu secondary, %llu shadow\n", (unsigned long long)c.primary_rays,
+                (unsigned long long)c.secondary_rays, (unsigned long long)c.shadow_rays);
+        fprintf(out, "Intersection: %.2f leaves, %.2f sphere tests, %.2f sphere hits and %.2f triangle tests per ray\n",
+                c.leaf_visits / n, c.sphere_tests / n, c.sphere_hits / n, c.triangle_tests / n);
+
+        fprintf(out, "Scatter:");
+        for (int i = 0; i < RenderCounters::material_kinds; i++)
+            fprintf(out, " %s %llu", material_name(i), (unsigned long long)c.scatters[i]);
+        fprintf(out, "\nPath ends:");
+        for (int i = 0; i < static_cast<int>(PathEnd::Count); i++)
+            fprintf(out, " %s %llu", end_name(i), (unsigned long long)c.path_ends[i]);
+        fprintf(out, "\nPath length histogram (segments: paths):\n");
+        for (int i = 0; i < used_depth_bins(); i++)
+        {
+            if (c.depth_histogram[i] > 0)
+                fprintf(out, "  %2d%s: %llu\n", i, i == RenderCounters::depth_bins - 1 ? "+" : "",
+                        (unsigned long long)c.depth_histogram[i]);
+        }
+
+        // The slowest tiles point at the expensive parts of the image.
+        std::vector<TileCost> slowest = tile_totals();
+        std::sort(slowest.begin(), slowest.end(),
+                  [](const TileCost &a, const TileCost &b) { return a.seconds > b.seconds; });
+        if (slowest.size() > 5)
+            slowest.resize(5);
+        fprintf(out, "Slowest tiles:\n");
+        for (const TileCost &t : slowest)
+            fprintf(out, "  [%d, %d) x [%d, %d): %.3f ms\n", t.tile.x0, t.tile.x1, t.tile.y0, t.tile.y1,
+                    1e3 * t.seconds);
+    }
+
+    void write_json(FILE *out) const
+    {
+        const RenderCounters &c = counters;
+        fprintf(out, "{\n  \"threads\": %d,\n  \"seconds\": %.6f,\n", threads, seconds);
+        fprintf(out, "  \"rays\": {\"primary\": %llu, \"secondary\": %llu, \"shadow\": %llu},\n",
+                (unsigned long long)c.primary_rays, (unsigned long long)c.secondary_rays,
+                (unsigned long long)c.shadow_rays);
+        fprintf(out,
+                "  \"intersection\": {\"leaf_visits\": %llu, \"sphere_tests\": %llu, \"sphere_hits\": %llu, "
+                "\"triangle_tests\": %llu},\n",
+                (unsigned long long)c.leaf_visits, (unsigned long long)c.sphere_tests,
+                (unsigned long long)c.sphere_hits, (unsigned long long)c.triangle_tests);
+
+        fprintf(out, "  \"scatter\": {");
+        for (int i = 0; i < RenderCounters::material_kinds; i++)
+            fprintf(out, "%s\"%s\": %llu", i ? ", " : "", material_name(i), (unsigned long long)c.scatters[i]);
+        fprintf(out, "},\n  \"path_ends\": {");
+        for (int i = 0; i < static_cast<int>(PathEnd::Count); i++)
+            fprintf(out, "%s\"%s\": %llu", i ? ", " : "", end_name(i), (unsigned long long)c.path_ends[i]);
+        fprintf(out, "},\n  \"depth_histogram\": [");
+        for (int i = 0; i < used_depth_bins(); i++)
+            fprintf(out, "%s%llu", i ? ", " : "", (unsigned long long)c.depth_histogram[i]);
+
+        fprintf(out, "],\n  \"tiles\": [");
+        for (size_t i = 0; i < tiles.size(); i++)
+        {
+            const TileCost &t = tiles[i];
+            fprintf(out, "%s\n    {\"x0\": %d, \"y0\": %d, \"x1\": %d, \"y1\": %d, \"seconds\": %.6f}",
+                    i ? "," : "", t.tile.x0, t.tile.y0, t.tile.x1, t.tile.y1, t.seconds);
+        }
+        fprintf(out, "\n  ]\n}\n");
+    }
+
+    // Write the report to path, as JSON if it ends in .json and as text
+    // otherwise. "-" writes text to stderr.
+    bool write(const char *path) const
+    {
+        if (!strcmp(path, "-"))
+        {
+            write_text(stderr);
+            return true;
+        }
+        FILE *f = fopen(path, "w");
+        if (f == NULL)
+        {
+            fprintf(stderr, "ERROR: Could not open '%s' for writing.\n", path);
+            return false;
+        }
+        const size_t len = strlen(path);
+        if (len >= 5 && !strcmp(path + len - 5, ".json"))
+            write_json(f);
+        else
+            write_text(f);
+        return fclose(f) == 0;
+    }
+
+    // Paint every tile with its total cost per pixel, scaled to the most
+    // expensive tile, on a blue (cheap) to red (costly) ramp. Pixels are
+    // laid out like the accumulation buffer.
+    void tile_heatmap(int width, int height, float *rgb) const
+    {
+        const std::vector<TileCost> totals = tile_totals();
+        double worst = 0.0;
+        for (const TileCost &t : totals)
+            worst = std::max(worst, t.seconds / t.tile.pixels());
+        std::fill(rgb, rgb + 3 * width * height, 0.0f);
+        for (const TileCost &t : totals)
+        {
+            const Vec3 color = HeatColor(worst > 0 ? t.seconds / t.tile.pixels() / worst : 0.0);
+            for (int j = t.tile.y0; j < t.tile.y1; j++)
+            {
+                for (int i = t.tile.x0; i < t.tile.x1; i++)
+                {
+                    float *p = rgb + 3 * ((height - j - 1) * width + i);
+                    p[0] = static_cast<float>(color.x);
+                    p[1] = static_cast<float>(color.y);
+                    p[2] = static_cast<float>(color.z);
+                }
+            }
+        }
+    }
+};
+
+#endif
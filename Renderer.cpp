@@ -0,0 +1,785 @@
+#include "Renderer.hpp"
+
+#include "Adaptive.hpp"
+#include "Camera.hpp"
+#include "Checkpoint.hpp"
+#include "DefaultScene.hpp"
+#include "Denoiser.hpp"
+#include "Distributed.hpp"
+#include "ImageIO.hpp"
+#include "PathTracer.hpp"
+#include "RenderStats.hpp"
+#include "Sampler.hpp"
+#include "Scene.hpp"
+#include "SceneFile.hpp"
+#include "TileScheduler.hpp"
+#include "Vec3.hpp"
+#include "Wavefront.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Everything a renderer holds between load() and the end of its last frame.
+struct Renderer::Impl
+{
+    RenderSettings settings;
+    SceneDescription desc;
+    Scene scene;
+    PathSettings path;
+    AdaptiveSettings adaptive;
+    SamplerSettings sampling;
+    int threads = 1;
+    int tilesize = 32;
+
+    // Size of the whole image, and the window of it that is rendered, with
+    // its top left corner at (x0, y0). Pixels are addressed within the
+    // window, (i, j) counting rows from the bottom, and keep the camera
+    // position and sample numbers they have in the whole image.
+    int full_width = 0, full_height = 0;
+    int x0 = 0, y0 = 0;
+    int width = 0, height = 0;
+    int max_spp = 0;
+    // Sample counts at the end of each pass.
+    vector<int> pass_end;
+    unique_ptr<Camera> cam;
+
+    // The per-pixel sum of linear radiance and the number of samples it
+    // holds, stored top row first.
+    vector<Vec3> accum;
+    vector<int> samples;
+    // Pixels restored from a checkpoint or merged from parts, which are not rendered.
+    vector<char> restored;
+    // First-hit albedo, normal and depth, kept when denoising or asked for.
+    AuxBuffers aux;
+    AuxImages aux_images;
+    bool keep_aux = false;
+    // Adaptive sampling's running estimate of every pixel, carried from one
+    // pass to the next.
+    vector<PixelEstimate> estimates;
+
+    // Set when the time limit runs out or the render is cancelled; workers
+    // stop at the next pixel. Cleared when a render's workers are done.
+    atomic<bool> stop{false};
+    bool stopped = false;
+
+    // While previews are taken the calling thread reads the accumulation
+    // buffer as the workers write it. Rows are guarded by a small set of
+    // locks, held only while a pixel's sums are stored or a row is read.
+    bool guarded = false;
+    vector<mutex> row_locks = vector<mutex>(64);
+
+    RenderReport report;
+    PathStats stats;
+    int passes_done = 0;
+
+    // Say what the renderer is doing, unless it was asked to keep quiet.
+    void note(const char *format, ...) const
+    {
+        if (settings.log == NULL)
+            return;
+        va_list args;
+        va_start(args, format);
+        vfprintf(settings.log, format, args);
+        va_end(args);
+    }
+
+    bool load(const RenderSettings &s);
+    bool render(int frame, float *rgb, const RenderCallbacks &callbacks);
+
+    void store_pixel(int index, const Vec3 &color, int s)
+    {
+        if (guarded)
+        {
+            lock_guard<mutex> guard(row_locks[index / width % row_locks.size()]);
+            accum[index] = color;
+            samples[index] = s;
+            return;
+        }
+        accum[index] = color;
+        samples[index] = s;
+    }
+
+    // Camera ray of a sample of pixel (i, j) of the window.
+    Ray camera_ray(int i, int j, Sampler &sampler) const
+    {
+        double du, dv;
+        sampler.next_2d(du, dv);
+        const double u = (x0 + i + du) / full_width;
+        const double v = (full_height - y0 - height + j + dv) / full_height;
+        return cam->get_ray(u, v, sampler);
+    }
+
+    // Sampler of a sample of pixel (i, j) of the window, keyed on the
+    // pixel's place in the whole image.
+    Sampler pixel_sampler(int i, int j, int s) const
+    {
+        return Sampler(sampling, x0 + i, full_height - y0 - height + j, s);
+    }
+
+    bool render_tile(const Tile &tile, int begin, int end, PathStats &stats, int &rendered);
+    bool render_tile_wavefront(const Tile &tile, int begin, int end, PathStats &stats, Wavefront &wave, int &rendered);
+};
+
+bool Renderer::Impl::load(const RenderSettings &s)
+{
+    settings = s;
+    if (settings.resume && settings.checkpoint_file.empty())
+    {
+        fprintf(stderr, "ERROR: Resuming needs a checkpoint file.\n");
+        return false;
+    }
+    const bool job = !settings.worker_dir.empty() || !settings.merge_dir.empty();
+    if (job && (!settings.checkpoint_file.empty() || (!settings.worker_dir.empty() && !settings.merge_dir.empty())))
+    {
+        fprintf(stderr, "ERROR: --worker and --merge cannot be combined with each other or with --checkpoint.\n");
+        return false;
+    }
+    keep_aux = settings.denoise || settings.keep_aovs;
+    if (keep_aux && (settings.resume || job))
+    {
+        fprintf(stderr, "ERROR: --denoise and --aov need the whole frame rendered by this process "
+                        "(no --resume, --worker or --merge).\n");
+        return false;
+    }
+    // A deadline needs passes over the whole image to leave a usable one.
+    if (settings.time_limit > 0)
+        settings.progressive = true;
+    if (settings.progressive && (!settings.checkpoint_file.empty() || job))
+    {
+        fprintf(stderr, "ERROR: --progressive and --time-limit cannot be combined with --checkpoint, --worker or --merge.\n");
+        return false;
+    }
+
+    // Load the scene description and its render settings.
+    if (settings.scene_file.empty())
+        desc = SetUpScene();
+    else if (!LoadSceneFile(settings.scene_file.c_str(), desc))
+        return false;
+    if (settings.width > 0 && settings.height > 0)
+    {
+        desc.width = settings.width;
+        desc.height = settings.height;
+    }
+    if (settings.spp > 0)
+        desc.spp = settings.spp;
+    if (settings.maxdepth > 0)
+        desc.maxdepth = settings.maxdepth;
+
+    // The window, scaled down with the image.
+    const int scale = max(1, settings.downscale);
+    full_width = max(1, desc.width / scale);
+    full_height = max(1, desc.height / scale);
+    int x1 = full_width, y1 = full_height;
+    if (settings.crop_x1 > settings.crop_x0 && settings.crop_y1 > settings.crop_y0)
+    {
+        x0 = max(0, settings.crop_x0 / scale);
+        y0 = max(0, settings.crop_y0 / scale);
+        x1 = min(full_width, (settings.crop_x1 + scale - 1) / scale);
+        y1 = min(full_height, (settings.crop_y1 + scale - 1) / scale);
+        if (x1 <= x0 || y1 <= y0)
+        {
+            fprintf(stderr, "ERROR: The crop window is outside the %dx%d image.\n", desc.width, desc.height);
+            return false;
+        }
+    }
+    width = x1 - x0;
+    height = y1 - y0;
+
+    path.maxdepth = desc.maxdepth;
+    path.rr_depth = settings.rr_depth;
+    path.rr_threshold = settings.rr_threshold;
+    path.light_sampling = settings.light_sampling;
+    threads = settings.threads > 0 ? settings.threads : static_cast<int>(thread::hardware_concurrency());
+    if (threads <= 0)
+        threads = 1;
+    tilesize = settings.tilesize > 0 ? settings.tilesize : 32;
+
+    // By default noisy pixels may spend up to twice the fixed budget.
+    adaptive = settings.adaptive;
+    if (adaptive.max_spp <= 0)
+        adaptive.max_spp = 2 * desc.spp;
+    adaptive.min_spp = max(1, min(adaptive.min_spp, adaptive.max_spp));
+    max_spp = adaptive.enabled ? adaptive.max_spp : desc.spp;
+    sampling.setup(settings.sampler, full_width, full_height, max_spp);
+
+    // A progressive render doubles the samples of every pixel pass by
+    // pass, which also keeps the Sobol and blue-noise samplers at their
+    // best-stratified power-of-two counts; otherwise each tile is finished
+    // in one go.
+    pass_end.clear();
+    if (settings.progressive)
+        for (int n = 1; n < max_spp; n *= 2)
+            pass_end.push_back(n);
+    pass_end.push_back(max_spp);
+
+    accum.assign(width * height, Vec3());
+    samples.assign(width * height, 0);
+    restored.assign(width * height, 0);
+    estimates.assign(adaptive.enabled ? width * height : 0, PixelEstimate());
+
+    // Set up the scene.
+    const auto build_start = chrono::steady_clock::now();
+    if (!BuildScene(desc, scene))
+        return false;
+    note("Scene: %d spheres, %d planes, %d boxes, %d meshes, %d textures and %d materials\n",
+         (int)scene.spheres.size(), (int)scene.planes.size(), (int)scene.boxes.size(), (int)scene.meshes.size(),
+         (int)scene.library.textures.textures.size(), (int)scene.library.materials.size());
+    note("Material library: %d interned records for %d requests\n", (int)scene.library.record_count(),
+         (int)scene.library.request_count());
+    if (!scene.meshes.empty())
+    {
+        long long triangles = 0;
+        for (const Mesh &mesh : scene.meshes)
+            triangles += mesh.triangles();
+        note("Meshes: %lld triangles, loaded and built in %.2f s\n", triangles,
+             chrono::duration<double>(chrono::steady_clock::now() - build_start).count());
+        for (size_t m = 0; m < scene.meshes.size() && settings.log; m++)
+        {
+            note("Mesh %d: ", (int)m);
+            scene.meshes[m].bvh.print_stats(settings.log);
+        }
+    }
+    scene.brute_force = settings.brute_force;
+    scene.soa.kernel = SelectSphereKernel(settings.simd.empty() ? NULL : settings.simd.c_str());
+    scene.build();
+    if (settings.log)
+        scene.bvh.print_stats(settings.log);
+    if (settings.log && !scene.meshes.empty())
+    {
+        note("Meshes ");
+        scene.mesh_bvh.print_stats(settings.log);
+    }
+    note("Sphere kernel: %s\n", SphereKernelName(scene.soa.kernel));
+    note("Lights: %d%s\n", (int)scene.lights.size(), path.light_sampling ? ", sampled directly" : "");
+    note("Sampler: %s\n", SamplerName(sampling.type));
+    return true;
+}
+
+// Render samples [begin, end) of a tile's pixels into the accumulation
+// buffer, adding to the sums of the passes before. Sets rendered to the
+// number of pixels done, skipping those restored from a checkpoint; pixels
+// that adaptive sampling finished in an earlier pass count as done.
+// Returns false if the render was stopped before the tile was finished.
+bool Renderer::Impl::render_tile(const Tile &tile, int begin, int end, PathStats &stats, int &rendered)
+{
+    rendered = 0;
+    for (int j = tile.y0; j < tile.y1; j++)
+    {
+        for (int i = tile.x0; i < tile.x1; i++)
+        {
+            if (stop.load(memory_order_relaxed))
+                return false;
+            const int index = (height - j - 1) * width + i;
+            if (restored[index])
+                continue;
+            rendered++;
+            if (samples[index] < begin)
+                continue;
+
+            Vec3 color(0, 0, 0);
+            PixelEstimate estimate;
+            AuxSum aux_sum;
+            FirstHit first;
+            if (begin > 0)
+            {
+                color = accum[index];
+                if (adaptive.enabled)
+                    estimate = estimates[index];
+                if (keep_aux)
+                    aux_sum.load(aux, index);
+            }
+
+            // Every sample's numbers are keyed on (pixel, sample), so the
+            // image does not depend on thread count, tile order or how
+            // the samples are split into passes.
+            int s = begin;
+            while (s < end)
+            {
+                Sampler sampler = pixel_sampler(i, j, s);
+                Ray r = camera_ray(i, j, sampler);
+                const Vec3 c = RayColor(r, scene, path, sampler, stats, keep_aux ? &first : NULL);
+                color += c;
+                s++;
+                if (keep_aux)
+                {
+                    aux_sum.add(first, c);
+                    first = FirstHit();
+                }
+
+                if (adaptive.enabled)
+                {
+                    estimate.add(Luminance(c));
+                    if (s >= adaptive.min_spp && s % adaptive.batch == 0 &&
+                        estimate.display_error() < adaptive.threshold)
+                        break;
+                }
+            }
+            store_pixel(index, color, s);
+            if (adaptive.enabled)
+                estimates[index] = estimate;
+            if (keep_aux)
+                aux_sum.store(aux, index);
+        }
+    }
+    return true;
+}
+
+// Render a tile with the wavefront integrator. Every pending pixel of the
+// tile takes the same samples in lockstep, one wave at a time: a wave is
+// one adaptive batch, or as many samples as fit in the wave budget.
+// Radiance is summed in sample order, so the result matches render_tile()
+// exactly. When stopped the pixels keep the samples of the waves already
+// traced, and the tile counts as unfinished.
+bool Renderer::Impl::render_tile_wavefront(const Tile &tile, int begin, int end, PathStats &stats, Wavefront &wave,
+                                           int &rendered)
+{
+    const int wave_paths = 1 << 16;
+    vector<int> pending;
+    bool finished = true;
+    rendered = 0;
+    for (int j = tile.y0; j < tile.y1; j++)
+    {
+        for (int i = tile.x0; i < tile.x1; i++)
+        {
+            const int index = (height - j - 1) * width + i;
+            if (restored[index])
+                continue;
+            rendered++;
+            if (samples[index] >= begin)
+                pending.push_back(j * width + i);
+        }
+    }
+
+    vector<Vec3> color(pending.size());
+    vector<PixelEstimate> estimate(pending.size());
+    vector<AuxSum> aux_sum(keep_aux ? pending.size() : 0);
+    if (begin > 0)
+    {
+        for (size_t p = 0; p < pending.size(); p++)
+        {
+            const int index = (height - pending[p] / width - 1) * width + pending[p] % width;
+            color[p] = accum[index];
+            if (adaptive.enabled)
+                estimate[p] = estimates[index];
+            if (keep_aux)
+                aux_sum[p].load(aux, index);
+        }
+    }
+    vector<Vec3> radiance;
+    vector<FirstHit> first;
+    int s = begin;
+    while (!pending.empty() && s < end)
+    {
+        int chunk = end - s;
+        if (adaptive.enabled)
+            chunk = min(chunk, adaptive.batch - s % adaptive.batch);
+        else
+            chunk = min(chunk, max(1, wave_paths / static_cast<int>(pending.size())));
+
+        for (size_t p = 0; p < pending.size(); p++)
+        {
+            const int i = pending[p] % width, j = pending[p] / width;
+            for (int k = 0; k < chunk; k++)
+            {
+                Sampler sampler = pixel_sampler(i, j, s + k);
+                const Ray r = camera_ray(i, j, sampler);
+                wave.add(r, sampler, static_cast<int>(p) * chunk + k);
+            }
+        }
+        radiance.resize(pending.size() * chunk);
+        if (keep_aux)
+            first.assign(pending.size() * chunk, FirstHit());
+        wave.trace(radiance.data(), stats, keep_aux ? first.data() : NULL);
+        s += chunk;
+
+        // Accumulate in sample order and retire converged pixels.
+        size_t kept = 0;
+        for (size_t p = 0; p < pending.size(); p++)
+        {
+            for (int k = 0; k < chunk; k++)
+            {
+                const Vec3 &c = radiance[p * chunk + k];
+                color[p] += c;
+                if (adaptive.enabled)
+                    estimate[p].add(Luminance(c));
+                if (keep_aux)
+                    aux_sum[p].add(first[p * chunk + k], c);
+            }
+            const int i = pending[p] % width, j = pending[p] / width;
+            const int index = (height - j - 1) * width + i;
+            const bool converged = adaptive.enabled && s >= adaptive.min_spp && s % adaptive.batch == 0 &&
+                                   estimate[p].display_error() < adaptive.threshold;
+            const bool cut = !converged && s < end && stop.load(memory_order_relaxed);
+            if (converged || s >= end || cut)
+            {
+                finished = finished && !cut;
+                store_pixel(index, color[p], s);
+                if (adaptive.enabled)
+                    estimates[index] = estimate[p];
+                if (keep_aux)
+                    aux_sum[p].store(aux, index);
+                continue;
+            }
+            pending[kept] = pending[p];
+            color[kept] = color[p];
+            estimate[kept] = estimate[p];
+            if (keep_aux)
+                aux_sum[kept] = aux_sum[p];
+            kept++;
+        }
+        pending.resize(kept);
+        color.resize(kept);
+        estimate.resize(kept);
+        if (keep_aux)
+            aux_sum.resize(kept);
+    }
+    return finished;
+}
+
+bool Renderer::Impl::render(int frame, float *rgb, const RenderCallbacks &callbacks)
+{
+    if (frame < 0 || frame >= desc.frames)
+    {
+        fprintf(stderr, "ERROR: The scene has frames 0 to %d.\n", desc.frames - 1);
+        return false;
+    }
+    const int pixels = width * height;
+    fill(accum.begin(), accum.end(), Vec3());
+    fill(samples.begin(), samples.end(), 0);
+    fill(restored.begin(), restored.end(), 0);
+    if (keep_aux)
+        aux.reset(pixels);
+
+    // Only moving spheres and the camera change between frames.
+    const SceneDescription::CameraDesc view = desc.camera_at(frame);
+    cam = make_unique<Camera>(view.eye, view.lookat, view.up, view.vfov,
+                              static_cast<double>(full_width) / full_height, view.aperture, view.focusdist);
+    cam->set_resolution(full_height);
+    if (AnimateScene(desc, frame, scene) && settings.log)
+    {
+        note("Frame %d: ", frame);
+        scene.bvh.print_stats(settings.log);
+    }
+
+    // Settings that change pixel values must match for a checkpoint to
+    // resume. The window only counts when there is one, so checkpoints of
+    // whole images stay valid.
+    Fingerprint fp;
+    fp.add(SceneFingerprint(desc))
+        .add(frame)
+        .add(sizeof(Real))
+        .add(static_cast<int>(sampling.type))
+        .add(desc.spp)
+        .add(path.maxdepth)
+        .add(path.rr_depth)
+        .add(path.rr_threshold)
+        .add(path.light_sampling)
+        .add(adaptive.enabled)
+        .add(adaptive.min_spp)
+        .add(max_spp)
+        .add(adaptive.threshold)
+        .add(adaptive.batch);
+    if (width != full_width || height != full_height)
+        fp.add(full_width).add(full_height).add(x0).add(y0);
+    const uint64_t fingerprint = fp.value();
+
+    // A worker joins the job in its directory, taking the job's tile size,
+    // and keeps its finished tiles in its part file as it would in a
+    // checkpoint.
+    unique_ptr<JobDirectory> job;
+    string checkpoint_file = settings.checkpoint_file;
+    int tiles_size = tilesize;
+    if (!settings.worker_dir.empty())
+    {
+        job = make_unique<JobDirectory>(settings.worker_dir.c_str());
+        if (!job->join(fingerprint, width, height, tiles_size))
+            return false;
+        checkpoint_file = job->part_path();
+    }
+
+    // Restore finished tiles from the checkpoint and skip their pixels.
+    Checkpoint checkpoint;
+    int restored_pixels = 0;
+    if (!settings.merge_dir.empty())
+    {
+        // Merging restores every pixel from the parts, leaving nothing to render.
+        const char *merge_dir = settings.merge_dir.c_str();
+        int parts = 0;
+        if (!JobDirectory(merge_dir).merge(fingerprint, width, height, accum.data(), samples.data(), restored, parts))
+            return false;
+        for (char r : restored)
+            restored_pixels += r;
+        note("Merged %d parts from '%s'\n", parts, merge_dir);
+        if (restored_pixels < pixels)
+        {
+            fprintf(stderr, "ERROR: %d pixels are in no part yet. If a worker died, delete the claims of its "
+                            "unfinished tiles (tile-X-Y in '%s') and start another worker.\n",
+                    pixels - restored_pixels, merge_dir);
+            return false;
+        }
+    }
+    else if (settings.resume)
+    {
+        vector<Tile> tiles;
+        if (!checkpoint.read(checkpoint_file.c_str(), width, height, fingerprint, accum.data(), samples.data(), tiles))
+            return false;
+        for (const Tile &tile : tiles)
+        {
+            for (int j = tile.y0; j < tile.y1; j++)
+            {
+                for (int i = tile.x0; i < tile.x1; i++)
+                {
+                    char &r = restored[(height - j - 1) * width + i];
+                    restored_pixels += !r;
+                    r = 1;
+                }
+            }
+        }
+        note("Resumed %d tiles (%d pixels) from '%s'\n", (int)tiles.size(), restored_pixels, checkpoint_file.c_str());
+    }
+
+    // Render the scene with a pool of workers pulling tiles from the scheduler.
+    vector<Tile> tiles;
+    for (const Tile &tile : TileScheduler::MakeTiles(width, height, tiles_size))
+    {
+        bool pending = false;
+        for (int j = tile.y0; j < tile.y1 && !pending; j++)
+            for (int i = tile.x0; i < tile.x1 && !pending; i++)
+                pending = !restored[(height - j - 1) * width + i];
+        if (pending)
+            tiles.push_back(tile);
+    }
+
+    // Every pass has its own scheduler over the same tiles. A worker whose
+    // pass has run dry moves on to the next without waiting for the
+    // others, so the passes overlap; only a tile whose previous pass is
+    // still being rendered elsewhere has to wait for it.
+    const int passes = static_cast<int>(pass_end.size());
+    vector<unique_ptr<TileScheduler>> schedulers;
+    for (int p = 0; p < passes; p++)
+        schedulers.push_back(make_unique<TileScheduler>(tiles, threads));
+    const int columns = (width + tiles_size - 1) / tiles_size;
+    vector<atomic<int>> tile_passes(columns * ((height + tiles_size - 1) / tiles_size));
+    vector<atomic<int>> pass_tiles(passes);
+    guarded = static_cast<bool>(callbacks.preview);
+
+    // Work is counted in samples, pixels finished early by adaptive
+    // sampling counting in full.
+    const long long total = static_cast<long long>(pixels) * max_spp;
+    atomic<long long> work_done(static_cast<long long>(restored_pixels) * max_spp);
+    atomic<int> running(threads);
+    vector<thread> workers;
+    vector<PathStats> worker_stats(threads);
+    report = RenderReport();
+    mutex report_lock;
+    const auto render_start = chrono::steady_clock::now();
+    for (int w = 0; w < threads; w++)
+    {
+        workers.emplace_back([&, w]() {
+            PathStats stats;
+            vector<TileCost> costs;
+            Wavefront wave(scene, path);
+            Tile tile;
+            for (int p = 0; p < passes && !stop.load(memory_order_relaxed); p++)
+            {
+                const int begin = p > 0 ? pass_end[p - 1] : 0;
+                while (!stop.load(memory_order_relaxed) && schedulers[p]->next(w, tile))
+                {
+                    // Tiles claimed by other processes of the job are theirs.
+                    if (job && !job->claim(tile))
+                    {
+                        work_done.fetch_add(static_cast<long long>(tile.pixels()) * max_spp, memory_order_relaxed);
+                        continue;
+                    }
+                    atomic<int> &tile_pass = tile_passes[tile.y0 / tiles_size * columns + tile.x0 / tiles_size];
+                    while (tile_pass.load(memory_order_acquire) < p && !stop.load(memory_order_relaxed))
+                        this_thread::yield();
+                    RT_STAT(const auto tile_start = chrono::steady_clock::now());
+                    int rendered = 0;
+                    const bool finished = settings.wavefront
+                                              ? render_tile_wavefront(tile, begin, pass_end[p], stats, wave, rendered)
+                                              : render_tile(tile, begin, pass_end[p], stats, rendered);
+                    RT_STAT(costs.push_back(TileCost{tile, chrono::duration<double>(chrono::steady_clock::now() - tile_start).count()}));
+                    // A tile cut short is neither checkpointed nor kept in
+                    // a part file; a worker hands its claim back instead.
+                    if (!finished)
+                    {
+                        if (job)
+                            job->release(tile);
+                        break;
+                    }
+                    checkpoint.add(tile);
+                    tile_pass.store(p + 1, memory_order_release);
+                    pass_tiles[p].fetch_add(1, memory_order_release);
+                    work_done.fetch_add(static_cast<long long>(rendered) * (pass_end[p] - begin), memory_order_relaxed);
+                }
+            }
+            worker_stats[w] = stats;
+            lock_guard<mutex> guard(report_lock);
+            report.add(ThreadCounters, costs);
+            running.fetch_sub(1, memory_order_release);
+        });
+    }
+
+    // Resolve the image as it stands, row by row under the row locks.
+    vector<float> linear(3 * pixels);
+    auto publish = [&]() {
+        for (int y = 0; y < height; y++)
+        {
+            lock_guard<mutex> guard(row_locks[y % row_locks.size()]);
+            ResolveLinear(&accum[y * width], &samples[y * width], width, linear.data() + 3 * y * width);
+        }
+        callbacks.preview(linear.data(), width, height);
+    };
+
+    // Report progress from this thread until every worker is done, and
+    // write checkpoints and previews from here so the workers never wait on
+    // the disk or the caller.
+    passes_done = 0;
+    auto last_checkpoint = chrono::steady_clock::now();
+    auto last_preview = last_checkpoint;
+    auto progress = [&]() {
+        if (callbacks.progress)
+        {
+            const int pass = min(passes_done, passes - 1);
+            callbacks.progress(RenderProgress{static_cast<double>(work_done.load(memory_order_relaxed)) / total,
+                                              pass, passes, pass_end[pass]});
+        }
+    };
+    auto count_passes = [&]() {
+        while (passes_done < passes && pass_tiles[passes_done].load(memory_order_acquire) == (int)tiles.size())
+            passes_done++;
+    };
+    while (running.load(memory_order_acquire) > 0)
+    {
+        progress();
+        this_thread::sleep_for(chrono::milliseconds(250));
+
+        const auto now = chrono::steady_clock::now();
+        if (!checkpoint_file.empty() &&
+            chrono::duration<double>(now - last_checkpoint).count() >= settings.checkpoint_interval)
+        {
+            checkpoint.write(checkpoint_file.c_str(), width, height, fingerprint, accum.data(), samples.data());
+            last_checkpoint = now;
+        }
+        if (settings.time_limit > 0 && chrono::duration<double>(now - render_start).count() >= settings.time_limit)
+            stop = true;
+
+        // Publish every few finished passes, and in between at the interval.
+        const int finished = passes_done;
+        count_passes();
+        if (callbacks.preview && running.load(memory_order_acquire) > 0 &&
+            ((passes_done > finished && passes_done % max(settings.preview_passes, 1) == 0) ||
+             (settings.preview_interval > 0 &&
+              chrono::duration<double>(now - last_preview).count() >= settings.preview_interval)))
+        {
+            publish();
+            last_preview = now;
+        }
+    }
+    for (thread &t : workers)
+        t.join();
+    count_passes();
+    progress();
+    // Clear the flag only now, so a cancel() made before the workers
+    // started still stops them.
+    stopped = stop.exchange(false);
+    report.threads = threads;
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - render_start).count();
+    if (!checkpoint_file.empty())
+        checkpoint.write(checkpoint_file.c_str(), width, height, fingerprint, accum.data(), samples.data());
+
+    stats = PathStats();
+    for (const PathStats &ws : worker_stats)
+        stats.merge(ws);
+
+    // A worker's output is its part file; the image comes from merging.
+    if (job)
+    {
+        note("Wrote %d tiles to '%s'\n", (int)checkpoint.size(), checkpoint_file.c_str());
+        return true;
+    }
+
+    // Resolve the accumulated samples, denoised if asked for.
+    if (keep_aux)
+        aux_images.resolve(aux, accum.data(), samples.data(), pixels);
+    if (rgb == NULL)
+        return true;
+    ResolveLinear(accum.data(), samples.data(), pixels, rgb);
+    if (settings.denoise)
+    {
+        const auto denoise_start = chrono::steady_clock::now();
+        Denoise(rgb, aux_images, width, height, threads, DenoiseSettings(), rgb);
+        note("Denoised in %.3f s\n", chrono::duration<double>(chrono::steady_clock::now() - denoise_start).count());
+    }
+    return true;
+}
+
+Renderer::Renderer() : impl(make_unique<Impl>()) {}
+
+Renderer::~Renderer() = default;
+
+bool Renderer::load(const RenderSettings &settings)
+{
+    impl = make_unique<Impl>();
+    return impl->load(settings);
+}
+
+int Renderer::width() const { return impl->width; }
+
+int Renderer::height() const { return impl->height; }
+
+int Renderer::frames() const { return impl->desc.frames; }
+
+int Renderer::threads() const { return impl->threads; }
+
+int Renderer::max_samples() const { return impl->max_spp; }
+
+bool Renderer::render(int frame, float *rgb, const RenderCallbacks &callbacks)
+{
+    return impl->render(frame, rgb, callbacks);
+}
+
+void Renderer::cancel() { impl->stop = true; }
+
+bool Renderer::stopped() const { return impl->stopped; }
+
+int Renderer::passes_done() const { return impl->passes_done; }
+
+int Renderer::passes() const { return static_cast<int>(impl->pass_end.size()); }
+
+const int *Renderer::sample_counts() const { return impl->samples.data(); }
+
+bool Renderer::aovs(float *albedo, float *normal, float *depth) const
+{
+    const AuxImages &aux = impl->aux_images;
+    if (!impl->keep_aux || aux.albedo.empty())
+        return false;
+    for (size_t i = 0; i < aux.albedo.size(); i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            if (albedo)
+                albedo[3 * i + c] = static_cast<float>(aux.albedo[i][c]);
+            if (normal)
+                normal[3 * i + c] = static_cast<float>(aux.normal[i][c]);
+        }
+        if (depth)
+            depth[i] = aux.depth[i];
+    }
+    return true;
+}
+
+const RenderReport &Renderer::report() const { return impl->report; }
+
+void Renderer::print_stats(FILE *out) const { impl->stats.print(out); }
@@ -0,0 +1,151 @@
+#ifndef RENDERER_HEADER_H
+#define RENDERER_HEADER_H
+
+#include "Adaptive.hpp"
+#include "RenderStats.hpp"
+#include "Sampler.hpp"
+
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+
+// Everything that decides how a scene is rendered. Sizes and counts left
+// at zero take the scene's own values.
+struct RenderSettings
+{
+    // Scene file to load; empty for the built-in scene.
+    std::string scene_file;
+    int width = 0, height = 0;
+    int spp = 0;
+    int maxdepth = 0;
+
+    // Window of the image to render, in pixels from the top left corner:
+    // columns [crop_x0, crop_x1) of rows [crop_y0, crop_y1). Its pixels
+    // come out exactly as in a render of the whole image. An empty window
+    // renders everything.
+    int crop_x0 = 0, crop_y0 = 0, crop_x1 = 0, crop_y1 = 0;
+    // Render at 1/downscale of the resolution, crop window included, for
+    // quick previews.
+    int downscale = 1;
+
+    // Worker threads; zero for one per hardware thread.
+    int threads = 0;
+    int tilesize = 32;
+    bool brute_force = false;
+    // Sphere kernel to force ("avx2", "sse4", "scalar"); empty for the best.
+    std::string simd;
+    bool wavefront = false;
+    SamplerType sampler = SamplerType::Sobol;
+    int rr_depth = 3;
+    double rr_threshold = 0.1;
+    bool light_sampling = true;
+    AdaptiveSettings adaptive;
+
+    // Render in passes that double the samples of every pixel, stopping
+    // early at time_limit seconds if that is set.
+    bool progressive = false;
+    double time_limit = 0.0;
+    // Previews are taken after every preview_passes passes and every
+    // preview_interval seconds.
+    int preview_passes = 1;
+    double preview_interval = 10.0;
+
+    // Checkpoint file written every checkpoint_interval seconds, and
+    // whether to resume from it.
+    std::string checkpoint_file;
+    double checkpoint_interval = 60.0;
+    bool resume = false;
+    // Job directory to render tiles for, or to merge the parts of.
+    std::string worker_dir;
+    std::string merge_dir;
+
+    bool denoise = false;
+    // Keep the first-hit albedo, normal and depth for aovs().
+    bool keep_aovs = false;
+
+    // Where the renderer says what it is doing; NULL keeps it quiet.
+    // Errors always go to stderr.
+    FILE *log = stderr;
+};
+
+// Progress of a render in flight.
+struct RenderProgress
+{
+    // Fraction of the samples taken.
+    double done;
+    // The pass being rendered and its sample count; a render that is not
+    // progressive has a single pass.
+    int pass;
+    int passes;
+    int spp;
+};
+
+// Hooks into a render, all called on the thread that called render().
+struct RenderCallbacks
+{
+    // Called about four times a second.
+    std::function<void(const RenderProgress &)> progress;
+    // Called with the image so far, laid out as render()'s output, as
+    // RenderSettings asks. Setting it is what turns previews on.
+    std::function<void(const float *rgb, int width, int height)> preview;
+};
+
+// Renderer class. Loads a scene once and renders frames of it into the
+// caller's buffers on a pool of threads of its own. Renderers share no
+// state, so any number of them can run at once in one process.
+class Renderer
+{
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+public:
+    Renderer();
+    ~Renderer();
+    Renderer(const Renderer &) = delete;
+    Renderer &operator=(const Renderer &) = delete;
+
+    // Load and build the scene. Returns false, with the reason on stderr,
+    // if it cannot be loaded or the settings do not go together.
+    bool load(const RenderSettings &settings);
+
+    // Size of the rendered image: the crop window, downscaled.
+    int width() const;
+    int height() const;
+    // Frames of the scene's animation.
+    int frames() const;
+    // Worker threads a render runs on.
+    int threads() const;
+    // Samples per pixel a pixel takes at most.
+    int max_samples() const;
+
+    // Render a frame into rgb, three floats of linear radiance per pixel,
+    // top row first; denoised if asked for. A worker of a job directory
+    // keeps its tiles in its part file instead, and rgb may be NULL.
+    // Returns false on failure.
+    bool render(int frame, float *rgb, const RenderCallbacks &callbacks = RenderCallbacks());
+
+    // Stop the render in progress at the next pixel, leaving the image so
+    // far. Called while no render runs, it stops the next render() as soon
+    // as it starts. Safe to call from any thread.
+    void cancel();
+
+    // What the last render did: whether it stopped early, how many of its
+    // passes were complete, and the sample count of every pixel.
+    bool stopped() const;
+    int passes_done() const;
+    int passes() const;
+    const int *sample_counts() const;
+
+    // The last render's mean first-hit albedo, unit normal (three floats
+    // per pixel) and depth (one), any of which may be NULL. Returns false
+    // unless keep_aovs was set.
+    bool aovs(float *albedo, float *normal, float *depth) const;
+
+    // Statistics of the last render.
+    const RenderReport &report() const;
+    void print_stats(FILE *out) const;
+};
+
+#endif
@@ -0,0 +1,340 @@
+#ifndef SAMPLER_HEADER_H
+#define SAMPLER_HEADER_H
+
+#include "Random.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+// How the random numbers of a pixel's samples are chosen.
+//
+//   Random      independent uniform numbers from the sample's own stream
+//   Stratified  correlated multi-jittered points (Kensler 2013): every
+//               dimension pair of a pixel's samples is jittered over an
+//               m x n grid and stratified in both 1D projections
+//   Sobol       the first two Sobol dimensions, with Owen scrambling and
+//               index shuffling seeded per pixel and dimension (Burley 2020)
+//   BlueNoise   one Owen-scrambled Sobol sequence laid over the image along
+//               a shuffled Morton curve (Ahmed and Wonka 2020), so that
+//               neighbouring pixels get complementary samples and what
+//               error remains is spread as blue noise
+enum class SamplerType
+{
+    Random,
+    Stratified,
+    Sobol,
+    BlueNoise,
+};
+
+// Parse a sampler name. Returns false if there is no such sampler.
+inline bool ParseSamplerType(const char *name, SamplerType &type)
+{
+    if (!strcmp(name, "random"))
+        type = SamplerType::Random;
+    else if (!strcmp(name, "stratified"))
+        type = SamplerType::Stratified;
+    else if (!strcmp(name, "sobol"))
+        type = SamplerType::Sobol;
+    else if (!strcmp(name, "bluenoise"))
+        type = SamplerType::BlueNoise;
+    else
+        return false;
+    return true;
+};
+
+inline const char *SamplerName(SamplerType type)
+{
+    switch (type)
+    {
+    case SamplerType::Random:
+        return "random";
+    case SamplerType::Stratified:
+        return "stratified";
+    case SamplerType::Sobol:
+        return "sobol";
+    default:
+        return "bluenoise";
+    }
+};
+
+// Sampler settings shared by every sample of a render.
+struct SamplerSettings
+{
+    SamplerType type = SamplerType::Sobol;
+    int width = 1;
+    // Samples per pixel; stratified patterns are laid out for this many.
+    int spp = 1;
+    // Blue noise: log2 of the samples per pixel rounded up to a power of
+    // two, and the number of base-4 digits of a sample's Morton index.
+    int log2_spp = 0;
+    int digits = 0;
+
+    void setup(SamplerType t, int w, int h, int samples)
+    {
+        type = t;
+        width = w;
+        spp = samples;
+        log2_spp = 0;
+        while ((1 << log2_spp) < samples)
+            log2_spp++;
+        int log2_size = 0;
+        while ((1 << log2_size) < w || (1 << log2_size) < h)
+            log2_size++;
+        digits = log2_size + (log2_spp + 1) / 2;
+    }
+};
+
+namespace SamplerDetail
+{
+// Hash a key and a counter into 32 bits.
+inline uint32_t Hash(uint64_t key, uint64_t counter)
+{
+    uint64_t x = key * 0xd1b54a32d192ed03ULL ^ counter;
+    return static_cast<uint32_t>(SplitMix64(x) >> 32);
+};
+
+inline uint32_t ReverseBits(uint32_t v)
+{
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+    v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+    return (v >> 16) | (v << 16);
+};
+
+// Owen scrambling: a random permutation of the binary digits in which each
+// digit is flipped depending on the digits above it, done with a hash that
+// only carries towards the top bits (Laine and Karras 2011, Vegdahl 2021).
+inline uint32_t OwenScramble(uint32_t v, uint32_t seed)
+{
+    v = ReverseBits(v);
+    v ^= v * 0x3d20adeau;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56u;
+    v ^= v * 0x53a22864u;
+    return ReverseBits(v);
+};
+
+// The first two dimensions of the Sobol sequence, as 32-bit fractions.
+inline uint32_t Sobol0(uint32_t index)
+{
+    return ReverseBits(index);
+};
+
+// The second dimension's generator matrix is Pascal's triangle mod 2:
+// digit j of the result is the parity of the index bits k with k a bitwise
+// superset of j, which five masked shifts sum without a loop over bits.
+inline uint32_t Sobol1(uint32_t index)
+{
+    index ^= (index >> 1) & 0x55555555u;
+    index ^= (index >> 2) & 0x33333333u;
+    index ^= (index >> 4) & 0x0f0f0f0fu;
+    index ^= (index >> 8) & 0x00ff00ffu;
+    index ^= (index >> 16) & 0x0000ffffu;
+    return ReverseBits(index);
+};
+
+// A random permutation of [0, l) applied to i, by hashing within the next
+// power of two and cycle-walking (Kensler 2013).
+inline uint32_t Permute(uint32_t i, uint32_t l, uint32_t p)
+{
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do
+    {
+        i ^= p;
+        i *= 0xe170893du;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3fu;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+};
+
+// Jitter in [0, 1) for sample i of pattern p.
+inline double Jitter(uint32_t i, uint32_t p)
+{
+    return Hash(i, p) * 0x1.0p-32;
+};
+
+// Spread the bits of a 16-bit number over the even bits.
+inline uint32_t SpreadBits(uint32_t x)
+{
+    x &= 0xffff;
+    x = (x | (x << 8)) & 0x00ff00ffu;
+    x = (x | (x << 4)) & 0x0f0f0f0fu;
+    x = (x | (x << 2)) & 0x33333333u;
+    x = (x | (x << 1)) & 0x55555555u;
+    return x;
+};
+
+// Every ordering of the four quadrants of a Morton cell.
+const uint8_t Quadrants[24][4] = {
+    {0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1}, {0, 3, 2, 1}, {0, 3, 1, 2},
+    {1, 0, 2, 3}, {1, 0, 3, 2}, {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 2, 0}, {1, 3, 0, 2},
+    {2, 1, 0, 3}, {2, 1, 3, 0}, {2, 0, 1, 3}, {2, 0, 3, 1}, {2, 3, 0, 1}, {2, 3, 1, 0},
+    {3, 1, 2, 0}, {3, 1, 0, 2}, {3, 2, 1, 0}, {3, 2, 0, 1}, {3, 0, 2, 1}, {3, 0, 1, 2},
+};
+} // namespace SamplerDetail
+
+// Sampler class. One is made for every sample of a pixel and hands out the
+// sample's random numbers dimension by dimension: two to jitter the pixel
+// position, two for the lens, then a block for every bounce. Keeping each
+// bounce's numbers in the same dimensions for every sample lets the
+// low-discrepancy samplers stratify them across the pixel's samples.
+// Samples are keyed on (pixel, sample index) alone, so like the random
+// streams they do not depend on thread count or tile order.
+class Sampler
+{
+private:
+    const SamplerSettings *settings;
+    uint32_t x, y, sample;
+    uint32_t pixel_seed;
+    int dimension = 0;
+    Rng rng;
+
+    static const int camera_dimensions = 4;
+    // Up to three for the scatter, three to sample a light and one for
+    // Russian roulette.
+    static const int bounce_dimensions = 8;
+
+    // Blue noise: the sample's index in the image-wide Sobol sequence for
+    // the given dimension. The Morton index of (pixel, sample) has its
+    // base-4 digits permuted, each by a hash of the digits above it, so
+    // that every dimension walks the image along a different curve. With
+    // an odd power of two samples the last digit is binary.
+    uint64_t blue_noise_index(int dim) const
+    {
+        using namespace SamplerDetail;
+        const int log2_spp = settings->log2_spp;
+        const uint64_t morton = (static_cast<uint64_t>(SpreadBits(x) | (SpreadBits(y) << 1)) << log2_spp) |
+                                (sample & ((1u << log2_spp) - 1));
+        const uint64_t salt = static_cast<uint64_t>(dim) * 0x55555555u + (sample >> log2_spp);
+        const bool odd = log2_spp & 1;
+        uint64_t index = 0;
+        for (int i = settings->digits - 1; i >= (odd ? 1 : 0); i--)
+        {
+            const int shift = 2 * i - (odd ? 1 : 0);
+            const int digit = (morton >> shift) & 3;
+            const uint32_t p = Hash(morton >> (shift + 2), salt) % 24;
+            index |= static_cast<uint64_t>(Quadrants[p][digit]) << shift;
+        }
+        if (odd)
+            index |= (morton & 1) ^ (Hash(morton >> 1, salt) & 1);
+        return index;
+    }
+
+public:
+    Sampler(const SamplerSettings &s, int px, int py, int index)
+        : settings(&s), x(px), y(py), sample(index),
+          rng(static_cast<uint64_t>(py) * s.width + px, index)
+    {
+        pixel_seed = SamplerDetail::Hash(static_cast<uint64_t>(py) * s.width + px, 0x5a4d706cULL);
+    }
+
+    // Move to the dimensions of the given bounce.
+    void start_bounce(int depth)
+    {
+        dimension = camera_dimensions + depth * bounce_dimensions;
+    }
+
+    // Next number in [0, 1).
+    double next_1d()
+    {
+        using namespace SamplerDetail;
+        const int dim = dimension++;
+        switch (settings->type)
+        {
+        case SamplerType::Random:
+            return rng.next_double();
+        case SamplerType::Stratified:
+        {
+            const uint32_t n = settings->spp;
+            const uint32_t p = Hash(pixel_seed, (static_cast<uint64_t>(sample / n) << 32) | dim);
+            const uint32_t s = sample % n;
+            return (Permute(s, n, p) + Jitter(s, p * 0x967a889bu)) / n;
+        }
+        case SamplerType::Sobol:
+        {
+            const uint32_t seed = Hash(pixel_seed, dim);
+            const uint32_t index = OwenScramble(sample, seed);
+            return OwenScramble(Sobol0(index), seed * 0x68bc21ebu + 1) * 0x1.0p-32;
+        }
+        default:
+        {
+            // Index bits past the 32 the sequence uses (in very large
+            // renders) pick a different scramble instead.
+            const uint64_t index = blue_noise_index(dim);
+            const uint32_t seed = Hash(dim, (index >> 32) ^ 0x6b6e6f62ULL);
+            return OwenScramble(Sobol0(static_cast<uint32_t>(index)), seed) * 0x1.0p-32;
+        }
+        }
+    }
+
+    // Next pair of numbers in [0, 1)^2, stratified together.
+    void next_2d(double &u, double &v)
+    {
+        using namespace SamplerDetail;
+        const int dim = dimension;
+        dimension += 2;
+        switch (settings->type)
+        {
+        case SamplerType::Random:
+            u = rng.next_double();
+            v = rng.next_double();
+            return;
+        case SamplerType::Stratified:
+        {
+            // Correlated multi-jittering over an m x n grid, m n >= spp.
+            const uint32_t count = settings->spp;
+            uint32_t m = 1;
+            while ((m + 1) * (m + 1) <= count)
+                m++;
+            const uint32_t n = (count + m - 1) / m;
+            const uint32_t p = Hash(pixel_seed, (static_cast<uint64_t>(sample / count) << 32) | dim);
+            const uint32_t s = Permute(sample % count, count, p * 0x51633e2du);
+            const uint32_t sx = Permute(s % m, m, p * 0x68bc21ebu);
+            const uint32_t sy = Permute(s / m, n, p * 0x02e5be93u);
+            u = (sx + (sy + Jitter(s, p * 0x967a889bu)) / n) / m;
+            v = (s + Jitter(s, p * 0x368cc8b7u)) / count;
+            return;
+        }
+        case SamplerType::Sobol:
+        {
+            const uint32_t seed = Hash(pixel_seed, dim);
+            const uint32_t index = OwenScramble(sample, seed);
+            u = OwenScramble(Sobol0(index), seed * 0x68bc21ebu + 1) * 0x1.0p-32;
+            v = OwenScramble(Sobol1(index), seed * 0x02e5be93u + 2) * 0x1.0p-32;
+            return;
+        }
+        default:
+        {
+            const uint64_t index = blue_noise_index(dim);
+            const uint32_t seed = Hash(dim, (index >> 32) ^ 0x6b6e6f62ULL);
+            u = OwenScramble(Sobol0(static_cast<uint32_t>(index)), seed) * 0x1.0p-32;
+            v = OwenScramble(Sobol1(static_cast<uint32_t>(index)), seed * 0x02e5be93u + 2) * 0x1.0p-32;
+            return;
+        }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,308 @@
+#ifndef SCENE_HEADER_H
+#define SCENE_HEADER_H
+
+#include "BVH.hpp"
+#include "Box.hpp"
+#include "HitRecord.hpp"
+#include "Light.hpp"
+#include "MaterialLibrary.hpp"
+#include "Mesh.hpp"
+#include "Plane.hpp"
+#include "Primitive.hpp"
+#include "RenderStats.hpp"
+#include "Ray.hpp"
+#include "Sphere.hpp"
+#include "SphereSoA.hpp"
+
+#include <vector>
+
+// Scene class. Owns the primitives, their materials and textures, and the
+// hierarchies built over the spheres and over the meshes; each mesh has a
+// hierarchy of its own over its triangles.
+class Scene
+{
+public:
+    MaterialLibrary library;
+    std::vector<Sphere> spheres;
+    SphereSoA soa;
+    BVH bvh;
+    // Planes are unbounded and boxes are few and mostly rooms around
+    // everything else, so both stay out of the hierarchy and are tested
+    // against every ray.
+    std::vector<Plane> planes;
+    std::vector<Box> boxes;
+    // Meshes sit in a hierarchy over their bounds, so a ray only descends
+    // into the triangles of the meshes whose boxes it crosses.
+    std::vector<Mesh> meshes;
+    BVH mesh_bvh;
+    // The emitting primitives, sampled by diffuse surfaces. Each emitter's
+    // light field indexes this list.
+    std::vector<Light> lights;
+    // Where each sphere went when build() reordered them: the sphere added
+    // k-th is spheres[slots[k]].
+    std::vector<int> slots;
+    // SAH cost of the hierarchy when it was last built.
+    double built_cost = 0.0;
+    // Skip the hierarchies and test every sphere and mesh, for validating
+    // the BVH.
+    bool brute_force = false;
+
+    Scene() = default;
+
+    // Build both hierarchies, reordering the spheres and meshes into their
+    // leaf order. The meshes' own hierarchies must be built already.
+    void build()
+    {
+        build_spheres();
+        build_meshes();
+    }
+
+    // Build the hierarchy over the spheres and reorder them into its leaf
+    // order.
+    void build_spheres()
+    {
+        std::vector<AABB> bounds;
+        bounds.reserve(spheres.size());
+        for (const Sphere &sph : spheres)
+            bounds.push_back(sph.bounds());
+
+        std::vector<int> order;
+        bvh.build(bounds, order);
+        built_cost = bvh.stats.sah_cost;
+
+        std::vector<Sphere> sorted;
+        sorted.reserve(spheres.size());
+        std::vector<int> moved(spheres.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            sorted.push_back(spheres[order[i]]);
+            moved[order[i]] = static_cast<int>(i);
+        }
+        spheres.swap(sorted);
+        soa.build(spheres);
+
+        if (slots.size() != spheres.size())
+        {
+            slots.resize(spheres.size());
+            for (size_t k = 0; k < slots.size(); k++)
+                slots[k] = static_cast<int>(k);
+        }
+        for (int &slot : slots)
+            slot = moved[slot];
+        collect_lights();
+    }
+
+    // Build the hierarchy over the meshes and reorder them into its leaf
+    // order. A mesh costs a whole traversal to test, so each leaf holds
+    // one, and the boxes take the same slack as the meshes' own.
+    void build_meshes()
+    {
+        std::vector<AABB> bounds;
+        bounds.reserve(meshes.size());
+        for (const Mesh &mesh : meshes)
+            bounds.push_back(mesh.bounds());
+
+        mesh_bvh.intersect_cost = 2.0;
+        mesh_bvh.max_leaf_size = 1;
+        mesh_bvh.slack = Mesh::box_slack();
+        std::vector<int> order;
+        mesh_bvh.build(bounds, order);
+
+        std::vector<Mesh> sorted;
+        sorted.reserve(meshes.size());
+        for (int i : order)
+            sorted.push_back(std::move(meshes[i]));
+        meshes.swap(sorted);
+    }
+
+    // Rebuild the light list from the emitting primitives.
+    void collect_lights()
+    {
+        lights.clear();
+        auto add = [&](Primitive &prim, const auto &shape) {
+            const Material &material = library.materials[prim.material];
+            prim.light = -1;
+            if (!material.emits())
+                return;
+            prim.light = static_cast<int>(lights.size());
+            lights.push_back(Light(shape, material.emitted() * prim.color));
+        };
+        for (Sphere &sph : spheres)
+            add(sph, SphereLight(sph.center, sph.radius));
+        for (Plane &plane : planes)
+            add(plane, PlaneLight(plane.axis, plane.offset));
+        for (Box &box : boxes)
+            add(box, BoxLight(box.lo, box.hi));
+        // Emitting meshes are not sampled; bounces still find them.
+        for (Mesh &mesh : meshes)
+            mesh.light = -1;
+    }
+
+    // Update the hierarchy after spheres moved. Refitting keeps the tree and
+    // only moves its boxes, which is far cheaper than a build but loosens
+    // the tree as spheres drift from their neighbours; once it costs half
+    // as much again to traverse as when built, it is rebuilt. Returns true
+    // on a rebuild.
+    bool refit()
+    {
+        std::vector<AABB> bounds;
+        bounds.reserve(spheres.size());
+        for (const Sphere &sph : spheres)
+            bounds.push_back(sph.bounds());
+        bvh.refit(bounds);
+        soa.build(spheres);
+        if (bvh.stats.sah_cost <= 1.5 * built_cost)
+        {
+            collect_lights();
+            return false;
+        }
+        build_spheres();
+        return true;
+    }
+
+    // Find the closest hit in [tmin, tmax], keeping only its distance and
+    // primitive. Returns false on a miss. Planes, boxes and meshes go first
+    // so that their hit bounds the traversal, and sphere candidates are
+    // tested on the SoA copy.
+    bool intersect(const Ray &ray, Real tmin, Real tmax, Hit &hit) const
+    {
+        hit = Hit();
+        for (size_t i = 0; i < planes.size(); i++)
+        {
+            if (planes[i].intersect(ray, tmin, tmax))
+            {
+                hit.index = static_cast<int>(i);
+                hit.kind = PrimitiveKind::Plane;
+            }
+        }
+        for (size_t i = 0; i < boxes.size(); i++)
+        {
+            if (boxes[i].intersect(ray, tmin, tmax))
+            {
+                hit.index = static_cast<int>(i);
+                hit.kind = PrimitiveKind::Box;
+            }
+        }
+        auto mesh_leaf = [&](int first, int count, Real &t) {
+            bool found = false;
+            for (int i = first; i < first + count; i++)
+            {
+                const int triangle = meshes[i].intersect(ray, tmin, t);
+                if (triangle >= 0)
+                {
+                    hit.index = i;
+                    hit.triangle = triangle;
+                    hit.kind = PrimitiveKind::Mesh;
+                    found = true;
+                }
+            }
+            return found;
+        };
+        if (brute_force)
+            mesh_leaf(0, static_cast<int>(meshes.size()), tmax);
+        else
+            mesh_bvh.traverse(ray, tmin, tmax, mesh_leaf);
+
+        int closest = -1;
+
+        if (brute_force)
+        {
+            closest = soa.intersect(ray, 0, soa.size(), tmin, tmax);
+            RT_STAT(ThreadCounters.sphere_tests += soa.size());
+            RT_STAT(ThreadCounters.sphere_hits += closest >= 0);
+        }
+        else
+        {
+            bvh.traverse(ray, tmin, tmax, [&](int first, int count, Real &t) {
+                const int i = soa.intersect(ray, first, count, tmin, t);
+                RT_STAT(ThreadCounters.leaf_visits++);
+                RT_STAT(ThreadCounters.sphere_tests += count);
+                RT_STAT(ThreadCounters.sphere_hits += i >= 0);
+                if (i < 0)
+                    return false;
+                closest = i;
+                return true;
+            });
+        }
+
+        if (closest >= 0)
+        {
+            hit.index = closest;
+            hit.kind = PrimitiveKind::Sphere;
+        }
+        hit.t = tmax;
+        return hit.kind != PrimitiveKind::None;
+    }
+
+    // Evaluate the surface at a hit found by intersect() into the hit
+    // record, and return the primitive hit.
+    const Primitive *interact(const Ray &ray, const Hit &hit, HitRecord &rec) const
+    {
+        switch (hit.kind)
+        {
+        case PrimitiveKind::Sphere:
+            spheres[hit.index].interact(ray, hit.t, rec);
+            return &spheres[hit.index];
+        case PrimitiveKind::Plane:
+            planes[hit.index].interact(ray, hit.t, rec);
+            return &planes[hit.index];
+        case PrimitiveKind::Box:
+            boxes[hit.index].interact(ray, hit.t, rec);
+            return &boxes[hit.index];
+        case PrimitiveKind::Mesh:
+            meshes[hit.index].interact(ray, hit.t, hit.triangle, rec);
+            return &meshes[hit.index];
+        default:
+            return NULL;
+        }
+    }
+
+    // Find the closest hit in [tmin, tmax] and fill in its hit record.
+    // Returns NULL on a miss.
+    const Primitive *hit(const Ray &ray, Real tmin, Real tmax, HitRecord &rec) const
+    {
+        Hit closest;
+        if (!intersect(ray, tmin, tmax, closest))
+            return NULL;
+        return interact(ray, closest, rec);
+    }
+
+    // Whether anything lies along the ray in [tmin, tmax]. Stops at the
+    // first primitive found and evaluates no surface.
+    bool occluded(const Ray &ray, Real tmin, Real tmax) const
+    {
+        for (const Plane &plane : planes)
+        {
+            Real t = tmax;
+            if (plane.intersect(ray, tmin, t))
+                return true;
+        }
+        for (const Box &box : boxes)
+        {
+            Real t = tmax;
+            if (box.intersect(ray, tmin, t))
+                return true;
+        }
+        auto mesh_leaf = [&](int first, int count) {
+            for (int i = first; i < first + count; i++)
+            {
+                if (meshes[i].occluded(ray, tmin, tmax))
+                    return true;
+            }
+            return false;
+        };
+        if (brute_force ? mesh_leaf(0, static_cast<int>(meshes.size()))
+                        : mesh_bvh.traverse_any(ray, tmin, tmax, mesh_leaf))
+            return true;
+
+        if (brute_force)
+            return soa.intersect(ray, 0, soa.size(), tmin, tmax) >= 0;
+        return bvh.traverse_any(ray, tmin, tmax, [&](int first, int count) {
+            RT_STAT(ThreadCounters.leaf_visits++);
+            RT_STAT(ThreadCounters.sphere_tests += count);
+            return soa.intersect(ray, first, count, tmin, tmax) >= 0;
+        });
+    }
+};
+
+#endif
@@ -0,0 +1,1011 @@
+#ifndef SCENEFILE_HEADER_H
+#define SCENEFILE_HEADER_H
+
+#include "Box.hpp"
+#include "Checkpoint.hpp"
+#include "Mesh.hpp"
+#include "ObjLoader.hpp"
+#include "Plane.hpp"
+#include "Scene.hpp"
+#include "Sphere.hpp"
+#include "Vec3.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Parsed scene: plain records that refer to each other by index. It is
+// what the text loader produces, what the binary cache stores, and what
+// BuildScene() turns into live materials, textures and primitives.
+struct SceneDescription
+{
+    struct TextureDesc
+    {
+        enum Type : int32_t
+        {
+            Constant,
+            Checker,
+            Image
+        } type;
+        Vec3d color;
+        int32_t even = -1, odd = -1;
+        std::string filename;
+    };
+
+    struct MaterialDesc
+    {
+        enum Type : int32_t
+        {
+            Lambertian,
+            Metal,
+            Dielectric,
+            Emissive
+        } type;
+        int32_t texture = -1;
+        // Metal albedo or emitted radiance.
+        Vec3d albedo;
+        // Metal fuzz or dielectric refractive index.
+        double param = 0.0;
+    };
+
+    struct SphereDesc
+    {
+        Vec3d center;
+        double radius;
+        Vec3d color;
+        // Index of the material, or -1 for a light that emits its color.
+        int32_t material;
+    };
+
+    struct PlaneDesc
+    {
+        // 0, 1 or 2 for a plane perpendicular to x, y or z.
+        int32_t axis;
+        double offset;
+        Vec3d color;
+        int32_t material;
+    };
+
+    struct BoxDesc
+    {
+        Vec3d lo, hi;
+        Vec3d color;
+        int32_t material;
+    };
+
+    // Triangle mesh loaded from an OBJ file, scaled about its origin and
+    // moved by offset.
+    struct MeshDesc
+    {
+        std::string filename;
+        Vec3d offset;
+        double scale;
+        Vec3d color;
+        int32_t material;
+    };
+
+    struct CameraDesc
+    {
+        Vec3d eye = Vec3d(50, 8, 25);
+        Vec3d lookat = Vec3d(50, 8, -1);
+        Vec3d up = Vec3d(0, 1, 0);
+        double vfov = 90;
+        double aperture = 0.1;
+        double focusdist = 10;
+    };
+
+    // Animation keys. Between keys values are interpolated linearly; before
+    // the first and after the last they hold.
+    struct CameraKey
+    {
+        int32_t frame;
+        CameraDesc camera;
+    };
+
+    struct MoveKey
+    {
+        int32_t frame;
+        int32_t sphere;
+        // Translation from the sphere's position in the description.
+        Vec3d offset;
+    };
+
+    // Render settings.
+    int32_t width = 1280;
+    int32_t height = 640;
+    int32_t spp = 3000;
+    int32_t maxdepth = 50;
+    int32_t frames = 1;
+    CameraDesc camera;
+
+    std::vector<TextureDesc> textures;
+    std::vector<MaterialDesc> materials;
+    std::vector<SphereDesc> spheres;
+    std::vector<PlaneDesc> planes;
+    std::vector<BoxDesc> boxes;
+    std::vector<MeshDesc> meshes;
+    std::vector<CameraKey> camera_keys;
+    std::vector<MoveKey> move_keys;
+
+    int constant(const Vec3d &color)
+    {
+        TextureDesc t;
+        t.type = TextureDesc::Constant;
+        t.color = color;
+        textures.push_back(t);
+        return static_cast<int>(textures.size()) - 1;
+    }
+
+    int checker(int even, int odd)
+    {
+        TextureDesc t;
+        t.type = TextureDesc::Checker;
+        t.even = even;
+        t.odd = odd;
+        textures.push_back(t);
+        return static_cast<int>(textures.size()) - 1;
+    }
+
+    int image(const std::string &filename)
+    {
+        TextureDesc t;
+        t.type = TextureDesc::Image;
+        t.filename = filename;
+        textures.push_back(t);
+        return static_cast<int>(textures.size()) - 1;
+    }
+
+    int lambertian(int texture)
+    {
+        MaterialDesc m;
+        m.type = MaterialDesc::Lambertian;
+        m.texture = texture;
+        materials.push_back(m);
+        return static_cast<int>(materials.size()) - 1;
+    }
+
+    int metal(const Vec3d &albedo, double fuzz)
+    {
+        MaterialDesc m;
+        m.type = MaterialDesc::Metal;
+        m.albedo = albedo;
+        m.param = fuzz;
+        materials.push_back(m);
+        return static_cast<int>(materials.size()) - 1;
+    }
+
+    int dielectric(double ref_idx)
+    {
+        MaterialDesc m;
+        m.type = MaterialDesc::Dielectric;
+        m.param = ref_idx;
+        materials.push_back(m);
+        return static_cast<int>(materials.size()) - 1;
+    }
+
+    int emissive(const Vec3d &radiance)
+    {
+        MaterialDesc m;
+        m.type = MaterialDesc::Emissive;
+        m.albedo = radiance;
+        materials.push_back(m);
+        return static_cast<int>(materials.size()) - 1;
+    }
+
+    void sphere(const Vec3d &center, double radius, const Vec3d &color, int material)
+    {
+        spheres.push_back(SphereDesc{center, radius, color, material});
+    }
+
+    void plane(int axis, double offset, const Vec3d &color, int material)
+    {
+        planes.push_back(PlaneDesc{axis, offset, color, material});
+    }
+
+    void box(const Vec3d &lo, const Vec3d &hi, const Vec3d &color, int material)
+    {
+        boxes.push_back(BoxDesc{lo, hi, color, material});
+    }
+
+    void mesh(const std::string &filename, const Vec3d &offset, double scale, const Vec3d &color, int material)
+    {
+        meshes.push_back(MeshDesc{filename, offset, scale, color, material});
+    }
+
+    // Find the keys of a track around frame: the last at or before it and
+    // the first after it, either of which may be missing. Returns the
+    // weight of next.
+    template <typename Key, typename F>
+    static double bracket(const std::vector<Key> &keys, int frame, F &&in_track, const Key *&prev, const Key *&next)
+    {
+        prev = next = NULL;
+        for (const Key &k : keys)
+        {
+            if (!in_track(k))
+                continue;
+            if (k.frame <= frame && (!prev || k.frame >= prev->frame))
+                prev = &k;
+            if (k.frame > frame && (!next || k.frame < next->frame))
+                next = &k;
+        }
+        if (!prev || !next)
+            return prev ? 0.0 : 1.0;
+        return static_cast<double>(frame - prev->frame) / (next->frame - prev->frame);
+    }
+
+    // Camera at a frame.
+    CameraDesc camera_at(int frame) const
+    {
+        const CameraKey *prev, *next;
+        const double w = bracket(camera_keys, frame, [](const CameraKey &) { return true; }, prev, next);
+        if (!prev && !next)
+            return camera;
+        const CameraDesc &a = prev ? prev->camera : next->camera;
+        const CameraDesc &b = next ? next->camera : prev->camera;
+        CameraDesc c;
+        c.eye = (1 - w) * a.eye + w * b.eye;
+        c.lookat = (1 - w) * a.lookat + w * b.lookat;
+        c.up = (1 - w) * a.up + w * b.up;
+        c.vfov = (1 - w) * a.vfov + w * b.vfov;
+        c.aperture = (1 - w) * a.aperture + w * b.aperture;
+        c.focusdist = (1 - w) * a.focusdist + w * b.focusdist;
+        return c;
+    }
+
+    // Centre of a sphere at a frame.
+    Vec3d center_at(int sphere, int frame) const
+    {
+        const MoveKey *prev, *next;
+        const double w = bracket(move_keys, frame, [&](const MoveKey &k) { return k.sphere == sphere; }, prev, next);
+        if (!prev && !next)
+            return spheres[sphere].center;
+        const Vec3d &a = prev ? prev->offset : next->offset;
+        const Vec3d &b = next ? next->offset : prev->offset;
+        return spheres[sphere].center + (1 - w) * a + w * b;
+    }
+
+    // Check that every reference points at an earlier, existing record.
+    bool valid() const
+    {
+        if (width <= 0 || height <= 0 || spp <= 0 || maxdepth <= 0 || frames <= 0)
+            return false;
+        for (size_t i = 0; i < textures.size(); i++)
+        {
+            const TextureDesc &t = textures[i];
+            if (t.type == TextureDesc::Checker &&
+                (t.even < 0 || t.odd < 0 || t.even >= static_cast<int>(i) || t.odd >= static_cast<int>(i)))
+                return false;
+        }
+        for (const MaterialDesc &m : materials)
+        {
+            if (m.type == MaterialDesc::Lambertian && (m.texture < 0 || m.texture >= static_cast<int>(textures.size())))
+                return false;
+        }
+        for (const SphereDesc &sph : spheres)
+        {
+            if (sph.material >= static_cast<int>(materials.size()))
+                return false;
+        }
+        for (const PlaneDesc &pl : planes)
+        {
+            if (pl.axis < 0 || pl.axis > 2 || pl.material >= static_cast<int>(materials.size()))
+                return false;
+        }
+        for (const BoxDesc &b : boxes)
+        {
+            if (b.lo.x > b.hi.x || b.lo.y > b.hi.y || b.lo.z > b.hi.z ||
+                b.material >= static_cast<int>(materials.size()))
+                return false;
+        }
+        for (const MeshDesc &m : meshes)
+        {
+            if (!(m.scale > 0) || m.material >= static_cast<int>(materials.size()))
+                return false;
+        }
+        for (const CameraKey &k : camera_keys)
+        {
+            if (k.frame < 0 || k.frame >= frames)
+                return false;
+        }
+        for (const MoveKey &k : move_keys)
+        {
+            if (k.frame < 0 || k.frame >= frames || k.sphere < 0 || k.sphere >= static_cast<int>(spheres.size()))
+                return false;
+        }
+        return true;
+    }
+};
+
+// Binary form of a SceneDescription. Fields are written one at a time, in
+// native byte order, so struct padding never reaches the file; strings
+// are length-prefixed.
+class SceneSerializer
+{
+private:
+    std::vector<unsigned char> &buf;
+    size_t pos = 0;
+    bool ok = true;
+
+    static const size_t sphere_bytes = 2 * sizeof(Vec3d) + sizeof(double) + sizeof(int32_t);
+
+public:
+    explicit SceneSerializer(std::vector<unsigned char> &b) : buf(b) {}
+
+    template <typename T>
+    void put(const T &v)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(&v);
+        buf.insert(buf.end(), p, p + sizeof(T));
+    }
+
+    void put(const std::string &s)
+    {
+        put(static_cast<uint32_t>(s.size()));
+        buf.insert(buf.end(), s.begin(), s.end());
+    }
+
+    template <typename T>
+    void get(T &v)
+    {
+        if (pos + sizeof(T) > buf.size())
+        {
+            ok = false;
+            return;
+        }
+        memcpy(&v, buf.data() + pos, sizeof(T));
+        pos += sizeof(T);
+    }
+
+    void get(std::string &s)
+    {
+        uint32_t n = 0;
+        get(n);
+        if (!ok || pos + n > buf.size())
+        {
+            ok = false;
+            return;
+        }
+        s.assign(reinterpret_cast<const char *>(buf.data()) + pos, n);
+        pos += n;
+    }
+
+    bool good() const { return ok; }
+
+    void write(const SceneDescription &d)
+    {
+        put(d.width);
+        put(d.height);
+        put(d.spp);
+        put(d.maxdepth);
+        put(d.frames);
+        put(d.camera);
+        put(static_cast<uint32_t>(d.textures.size()));
+        for (const auto &t : d.textures)
+        {
+            put(t.type);
+            put(t.color);
+            put(t.even);
+            put(t.odd);
+            put(t.filename);
+        }
+        put(static_cast<uint32_t>(d.materials.size()));
+        for (const auto &m : d.materials)
+        {
+            put(m.type);
+            put(m.texture);
+            put(m.albedo);
+            put(m.param);
+        }
+        put(static_cast<uint32_t>(d.spheres.size()));
+        buf.reserve(buf.size() + d.spheres.size() * sphere_bytes);
+        for (const auto &sph : d.spheres)
+        {
+            put(sph.center);
+            put(sph.radius);
+            put(sph.color);
+            put(sph.material);
+        }
+        put(static_cast<uint32_t>(d.planes.size()));
+        for (const auto &pl : d.planes)
+        {
+            put(pl.axis);
+            put(pl.offset);
+            put(pl.color);
+            put(pl.material);
+        }
+        put(static_cast<uint32_t>(d.boxes.size()));
+        for (const auto &b : d.boxes)
+        {
+            put(b.lo);
+            put(b.hi);
+            put(b.color);
+            put(b.material);
+        }
+        put(static_cast<uint32_t>(d.meshes.size()));
+        for (const auto &m : d.meshes)
+        {
+            put(m.filename);
+            put(m.offset);
+            put(m.scale);
+            put(m.color);
+            put(m.material);
+        }
+        put(static_cast<uint32_t>(d.camera_keys.size()));
+        for (const auto &k : d.camera_keys)
+        {
+            put(k.frame);
+            put(k.camera);
+        }
+        put(static_cast<uint32_t>(d.move_keys.size()));
+        for (const auto &k : d.move_keys)
+        {
+            put(k.frame);
+            put(k.sphere);
+            put(k.offset);
+        }
+    }
+
+    void read(SceneDescription &d)
+    {
+        get(d.width);
+        get(d.height);
+        get(d.spp);
+        get(d.maxdepth);
+        get(d.frames);
+        get(d.camera);
+        uint32_t n = 0;
+        get(n);
+        d.textures.resize(ok ? n : 0);
+        for (auto &t : d.textures)
+        {
+            get(t.type);
+            get(t.color);
+            get(t.even);
+            get(t.odd);
+            get(t.filename);
+        }
+        get(n);
+        d.materials.resize(ok ? n : 0);
+        for (auto &m : d.materials)
+        {
+            get(m.type);
+            get(m.texture);
+            get(m.albedo);
+            get(m.param);
+        }
+        get(n);
+        if (!ok || pos + sphere_bytes * n > buf.size())
+        {
+            ok = false;
+            return;
+        }
+        d.spheres.resize(n);
+        for (auto &sph : d.spheres)
+        {
+            get(sph.center);
+            get(sph.radius);
+            get(sph.color);
+            get(sph.material);
+        }
+        get(n);
+        d.planes.resize(ok ? n : 0);
+        for (auto &pl : d.planes)
+        {
+            get(pl.axis);
+            get(pl.offset);
+            get(pl.color);
+            get(pl.material);
+        }
+        get(n);
+        d.boxes.resize(ok ? n : 0);
+        for (auto &b : d.boxes)
+        {
+            get(b.lo);
+            get(b.hi);
+            get(b.color);
+            get(b.material);
+        }
+        get(n);
+        d.meshes.resize(ok ? n : 0);
+        for (auto &m : d.meshes)
+        {
+            get(m.filename);
+            get(m.offset);
+            get(m.scale);
+            get(m.color);
+            get(m.material);
+        }
+        get(n);
+        d.camera_keys.resize(ok ? n : 0);
+        for (auto &k : d.camera_keys)
+        {
+            get(k.frame);
+            get(k.camera);
+        }
+        get(n);
+        d.move_keys.resize(ok ? n : 0);
+        for (auto &k : d.move_keys)
+        {
+            get(k.frame);
+            get(k.sphere);
+            get(k.offset);
+        }
+    }
+};
+
+// Hash of a description, for checkpoint fingerprints.
+inline uint64_t SceneFingerprint(const SceneDescription &d)
+{
+    std::vector<unsigned char> buf;
+    SceneSerializer(buf).write(d);
+    Fingerprint f;
+    for (unsigned char c : buf)
+        f.add(c);
+    return f.value();
+};
+
+// Parse a text scene file. Each line holds one statement; '#' starts a
+// comment. Textures and materials are named and must be defined before use:
+//
+//   size <width> <height>
+//   spp <samples>
+//   maxdepth <bounces>
+//   frames <count>
+//   camera <eye xyz> <lookat xyz> <up xyz> <vfov> <aperture> <focusdist>
+//   texture <name> constant <r g b>
+//   texture <name> checker <even texture> <odd texture>
+//   texture <name> image <file>
+//   material <name> lambertian <texture>
+//   material <name> metal <r g b> <fuzz>
+//   material <name> dielectric <refractive index>
+//   material <name> emissive <radiance rgb>
+//   sphere <center xyz> <radius> <r g b> <material | light> [name]
+//   plane <x | y | z> <offset> <r g b> <material | light>
+//   box <min xyz> <max xyz> <r g b> <material | light>
+//   mesh <file.obj> <offset xyz> <scale> <r g b> <material | light>
+//   key <frame> camera <eye xyz> <lookat xyz> <up xyz> <vfov> <aperture> <focusdist>
+//   key <frame> move <sphere name> <offset xyz>
+//
+// Frames are numbered from 0. An animation moves the camera and named
+// spheres through their keys. Primitives with an emissive material are
+// lights, and 'light' is short for an emissive material of radiance 1:
+// the light then emits its colour. A mesh's triangles are read from the
+// OBJ file when the scene is built, scaled about the file's origin and
+// moved by the offset.
+inline bool ParseSceneFile(const char *filename, SceneDescription &desc)
+{
+    std::ifstream in(filename);
+    if (!in)
+    {
+        fprintf(stderr, "ERROR: Could not open scene file '%s'.\n", filename);
+        return false;
+    }
+
+    desc = SceneDescription();
+    std::map<std::string, int> textures, materials, spheres;
+    std::string line;
+    int lineno = 0;
+
+    auto fail = [&](const std::string &msg) {
+        fprintf(stderr, "ERROR: %s:%d: %s\n", filename, lineno, msg.c_str());
+        return false;
+    };
+
+    while (std::getline(in, line))
+    {
+        lineno++;
+        const size_t hash = line.find('#');
+        if (hash != std::string::npos)
+            line.erase(hash);
+
+        std::istringstream ss(line);
+        std::string cmd;
+        if (!(ss >> cmd))
+            continue;
+
+        auto vec = [&](Vec3d &v) { return static_cast<bool>(ss >> v.x >> v.y >> v.z); };
+        auto lookup = [&](std::map<std::string, int> &table, const std::string &name, int &index) {
+            auto it = table.find(name);
+            if (it == table.end())
+                return false;
+            index = it->second;
+            return true;
+        };
+
+        if (cmd == "size")
+        {
+            if (!(ss >> desc.width >> desc.height) || desc.width <= 0 || desc.height <= 0)
+                return fail("expected 'size <width> <height>'");
+        }
+        else if (cmd == "spp")
+        {
+            if (!(ss >> desc.spp) || desc.spp <= 0)
+                return fail("expected 'spp <samples>'");
+        }
+        else if (cmd == "maxdepth")
+        {
+            if (!(ss >> desc.maxdepth) || desc.maxdepth <= 0)
+                return fail("expected 'maxdepth <bounces>'");
+        }
+        else if (cmd == "frames")
+        {
+            if (!(ss >> desc.frames) || desc.frames <= 0)
+                return fail("expected 'frames <count>'");
+        }
+        else if (cmd == "camera")
+        {
+            SceneDescription::CameraDesc &c = desc.camera;
+            if (!vec(c.eye) || !vec(c.lookat) || !vec(c.up) || !(ss >> c.vfov >> c.aperture >> c.focusdist))
+                return fail("expected 'camera <eye> <lookat> <up> <vfov> <aperture> <focusdist>'");
+        }
+        else if (cmd == "texture")
+        {
+            std::string name, type;
+            if (!(ss >> name >> type))
+                return fail("expected 'texture <name> <type> ...'");
+            if (type == "constant")
+            {
+                Vec3d c;
+                if (!vec(c))
+                    return fail("expected 'texture <name> constant <r g b>'");
+                textures[name] = desc.constant(c);
+            }
+            else if (type == "checker")
+            {
+                std::string even, odd;
+                int e, o;
+                if (!(ss >> even >> odd))
+                    return fail("expected 'texture <name> checker <even> <odd>'");
+                if (!lookup(textures, even, e) || !lookup(textures, odd, o))
+                    return fail("unknown texture in checker '" + name + "'");
+                textures[name] = desc.checker(e, o);
+            }
+            else if (type == "image")
+            {
+                std::string file;
+                if (!(ss >> file))
+                    return fail("expected 'texture <name> image <file>'");
+                textures[name] = desc.image(file);
+            }
+            else
+            {
+                return fail("unknown texture type '" + type + "'");
+            }
+        }
+        else if (cmd == "material")
+        {
+            std::string name, type;
+            if (!(ss >> name >> type))
+                return fail("expected 'material <name> <type> ...'");
+            if (name == "light")
+                return fail("'light' is reserved for emitting primitives");
+            if (type == "lambertian")
+            {
+                std::string tex;
+                int t;
+                if (!(ss >> tex))
+                    return fail("expected 'material <name> lambertian <texture>'");
+                if (!lookup(textures, tex, t))
+                    return fail("unknown texture '" + tex + "'");
+                materials[name] = desc.lambertian(t);
+            }
+            else if (type == "metal")
+            {
+                Vec3d albedo;
+                double fuzz;
+                if (!vec(albedo) || !(ss >> fuzz))
+                    return fail("expected 'material <name> metal <r g b> <fuzz>'");
+                materials[name] = desc.metal(albedo, fuzz);
+            }
+            else if (type == "dielectric")
+            {
+                double ri;
+                if (!(ss >> ri))
+                    return fail("expected 'material <name> dielectric <refractive index>'");
+                materials[name] = desc.dielectric(ri);
+            }
+            else if (type == "emissive")
+            {
+                Vec3d radiance;
+                if (!vec(radiance))
+                    return fail("expected 'material <name> emissive <r g b>'");
+                materials[name] = desc.emissive(radiance);
+            }
+            else
+            {
+                return fail("unknown material type '" + type + "'");
+            }
+        }
+        else if (cmd == "sphere")
+        {
+            Vec3d center, color;
+            double radius;
+            std::string mat, name;
+            int m = -1;
+            if (!vec(center) || !(ss >> radius) || !vec(color) || !(ss >> mat))
+                return fail("expected 'sphere <center> <radius> <color> <material> [name]'");
+            if (mat != "light" && !lookup(materials, mat, m))
+                return fail("unknown material '" + mat + "'");
+            if (ss >> name)
+                spheres[name] = static_cast<int>(desc.spheres.size());
+            desc.sphere(center, radius, color, m);
+        }
+        else if (cmd == "plane")
+        {
+            std::string axis, mat;
+            double offset;
+            Vec3d color;
+            int m = -1;
+            if (!(ss >> axis >> offset) || !vec(color) || !(ss >> mat))
+                return fail("expected 'plane <axis> <offset> <color> <material>'");
+            if (axis != "x" && axis != "y" && axis != "z")
+                return fail("plane axis must be x, y or z");
+            if (mat != "light" && !lookup(materials, mat, m))
+                return fail("unknown material '" + mat + "'");
+            desc.plane(axis[0] - 'x', offset, color, m);
+        }
+        else if (cmd == "box")
+        {
+            Vec3d lo, hi, color;
+            std::string mat;
+            int m = -1;
+            if (!vec(lo) || !vec(hi) || !vec(color) || !(ss >> mat))
+                return fail("expected 'box <min> <max> <color> <material>'");
+            if (lo.x > hi.x || lo.y > hi.y || lo.z > hi.z)
+                return fail("box corners must be given as min then max");
+            if (mat != "light" && !lookup(materials, mat, m))
+                return fail("unknown material '" + mat + "'");
+            desc.box(lo, hi, color, m);
+        }
+        else if (cmd == "mesh")
+        {
+            std::string file, mat;
+            Vec3d offset, color;
+            double scale;
+            int m = -1;
+            if (!(ss >> file) || !vec(offset) || !(ss >> scale) || !vec(color) || !(ss >> mat))
+                return fail("expected 'mesh <file> <offset> <scale> <color> <material>'");
+            if (!(scale > 0))
+                return fail("mesh scale must be positive");
+            if (mat != "light" && !lookup(materials, mat, m))
+                return fail("unknown material '" + mat + "'");
+            desc.mesh(file, offset, scale, color, m);
+        }
+        else if (cmd == "key")
+        {
+            int frame;
+            std::string type;
+            if (!(ss >> frame >> type) || frame < 0)
+                return fail("expected 'key <frame> <camera | move> ...'");
+            if (type == "camera")
+            {
+                SceneDescription::CameraDesc c;
+                if (!vec(c.eye) || !vec(c.lookat) || !vec(c.up) || !(ss >> c.vfov >> c.aperture >> c.focusdist))
+                    return fail("expected 'key <frame> camera <eye> <lookat> <up> <vfov> <aperture> <focusdist>'");
+                desc.camera_keys.push_back(SceneDescription::CameraKey{frame, c});
+            }
+            else if (type == "move")
+            {
+                std::string name;
+                int s;
+                Vec3d offset;
+                if (!(ss >> name) || !vec(offset))
+                    return fail("expected 'key <frame> move <sphere> <offset>'");
+                if (!lookup(spheres, name, s))
+                    return fail("unknown sphere '" + name + "'");
+                desc.move_keys.push_back(SceneDescription::MoveKey{frame, s, offset});
+            }
+            else
+            {
+                return fail("unknown key type '" + type + "'");
+            }
+        }
+        else
+        {
+            return fail("unknown statement '" + cmd + "'");
+        }
+    }
+    // Keys may come before the frame count, so they are checked at the end.
+    for (const auto &k : desc.camera_keys)
+    {
+        if (k.frame >= desc.frames)
+            return fail("camera key at frame " + std::to_string(k.frame) + " is past the last frame");
+    }
+    for (const auto &k : desc.move_keys)
+    {
+        if (k.frame >= desc.frames)
+            return fail("move key at frame " + std::to_string(k.frame) + " is past the last frame");
+    }
+    return true;
+};
+
+// Load a scene file through its binary cache, "<file>.cache". The cache is
+// used when it was written for a source of the same size and modification
+// time; otherwise the text is parsed and the cache rewritten.
+inline bool LoadSceneFile(const char *filename, SceneDescription &desc)
+{
+    static const char magic[4] = {'R', 'T', 'S', 'C'};
+    static const uint32_t version = 4;
+
+    struct stat st;
+    if (stat(filename, &st) != 0)
+    {
+        fprintf(stderr, "ERROR: Could not open scene file '%s'.\n", filename);
+        return false;
+    }
+    const int64_t size = st.st_size;
+    const int64_t mtime = st.st_mtime;
+    const std::string cache = std::string(filename) + ".cache";
+
+    // Try the cache first.
+    if (FILE *f = fopen(cache.c_str(), "rb"))
+    {
+        std::vector<unsigned char> buf;
+        unsigned char chunk[1 << 16];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+            buf.insert(buf.end(), chunk, chunk + n);
+        fclose(f);
+
+        SceneSerializer s(buf);
+        char m[4] = {0};
+        uint32_t v = 0;
+        int64_t cached_size = -1, cached_mtime = -1;
+        for (char &c : m)
+            s.get(c);
+        s.get(v);
+        s.get(cached_size);
+        s.get(cached_mtime);
+        if (s.good() && !memcmp(m, magic, 4) && v == version && cached_size == size && cached_mtime == mtime)
+        {
+            s.read(desc);
+            if (s.good() && desc.valid())
+                return true;
+        }
+    }
+
+    if (!ParseSceneFile(filename, desc))
+        return false;
+
+    // Refresh the cache; failing to write it is not an error.
+    std::vector<unsigned char> buf;
+    SceneSerializer s(buf);
+    for (char c : magic)
+        s.put(c);
+    s.put(version);
+    s.put(size);
+    s.put(mtime);
+    s.write(desc);
+    // Renderers loading the same scene at once each write a file of their
+    // own; whichever is renamed last wins.
+    std::string tmp = cache + ".XXXXXX";
+    const int fd = mkstemp(&tmp[0]);
+    if (FILE *f = fd >= 0 ? fdopen(fd, "wb") : NULL)
+    {
+        const bool ok = fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+        if (fclose(f) == 0 && ok)
+            rename(tmp.c_str(), cache.c_str());
+        else
+            remove(tmp.c_str());
+    }
+    return true;
+};
+
+// Instantiate a description: materials and textures go into the scene's
+// library, which shares identical ones between primitives, and meshes are
+// loaded and their hierarchies built. Returns false if a mesh cannot be
+// loaded.
+inline bool BuildScene(const SceneDescription &desc, Scene &scene)
+{
+    std::vector<int> textures;
+    for (const auto &t : desc.textures)
+    {
+        switch (t.type)
+        {
+        case SceneDescription::TextureDesc::Constant:
+            textures.push_back(scene.library.constant(Vec3(t.color)));
+            break;
+        case SceneDescription::TextureDesc::Checker:
+            textures.push_back(scene.library.checker(textures[t.even], textures[t.odd]));
+            break;
+        case SceneDescription::TextureDesc::Image:
+            textures.push_back(scene.library.image(t.filename));
+            break;
+        }
+    }
+
+    std::vector<int> materials;
+    for (const auto &m : desc.materials)
+    {
+        switch (m.type)
+        {
+        case SceneDescription::MaterialDesc::Lambertian:
+            materials.push_back(scene.library.lambertian(textures[m.texture]));
+            break;
+        case SceneDescription::MaterialDesc::Metal:
+            materials.push_back(scene.library.metal(Vec3(m.albedo), m.param));
+            break;
+        case SceneDescription::MaterialDesc::Dielectric:
+            materials.push_back(scene.library.dielectric(m.param));
+            break;
+        case SceneDescription::MaterialDesc::Emissive:
+            materials.push_back(scene.library.emissive(Vec3(m.albedo)));
+            break;
+        }
+    }
+    // Primitives marked as lights emit their colour.
+    auto material = [&](int m) { return m >= 0 ? materials[m] : scene.library.emissive(Vec3(1, 1, 1)); };
+
+    scene.spheres.clear();
+    scene.spheres.reserve(desc.spheres.size());
+    int misplaced = 0;
+    double worst = 0.0;
+    for (const auto &s : desc.spheres)
+    {
+        scene.spheres.push_back(Sphere(Vec3(s.center), s.radius, Vec3(s.color), material(s.material)));
+
+        // Rounding to Real moves the surface by up to the change in center
+        // and radius; huge spheres standing in for walls move a long way.
+        const Sphere &sph = scene.spheres.back();
+        const double moved = (Vec3d(sph.center) - s.center).length() + fabs(sph.radius - s.radius);
+        if (moved > 1e-3)
+        {
+            misplaced++;
+            worst = std::max(worst, moved);
+        }
+    }
+    if (misplaced > 0)
+        fprintf(stderr, "WARNING: %d spheres are too large for single precision (surfaces move by up to %g); "
+                        "model walls with planes or boxes, or use a double build.\n",
+                misplaced, worst);
+
+    scene.planes.clear();
+    for (const auto &pl : desc.planes)
+        scene.planes.push_back(Plane(pl.axis, pl.offset, Vec3(pl.color), material(pl.material)));
+    scene.boxes.clear();
+    for (const auto &b : desc.boxes)
+        scene.boxes.push_back(Box(Vec3(b.lo), Vec3(b.hi), Vec3(b.color), material(b.material)));
+    scene.meshes.clear();
+    scene.meshes.reserve(desc.meshes.size());
+    for (const auto &m : desc.meshes)
+    {
+        scene.meshes.push_back(Mesh(Vec3(m.color), material(m.material)));
+        Mesh &mesh = scene.meshes.back();
+        if (!LoadObj(m.filename.c_str(), mesh))
+            return false;
+        mesh.place(Vec3(m.offset), static_cast<Real>(m.scale));
+        mesh.build();
+    }
+    return true;
+};
+
+// Move a built scene to a frame of its animation: the spheres with move
+// keys go to their positions at the frame and the hierarchy is refitted.
+// Returns false if the scene has nothing that moves.
+inline bool AnimateScene(const SceneDescription &desc, int frame, Scene &scene)
+{
+    if (desc.move_keys.empty())
+        return false;
+    std::vector<char> moving(desc.spheres.size(), 0);
+    for (const auto &k : desc.move_keys)
+        moving[k.sphere] = 1;
+    for (size_t s = 0; s < desc.spheres.size(); s++)
+    {
+        if (moving[s])
+            scene.spheres[scene.slots[s]].center = Vec3(desc.center_at(static_cast<int>(s), frame));
+    }
+    scene.refit();
+    return true;
+};
+
+#endif
@@ -1,33 +1,41 @@
 #ifndef SPHERE_HEADER_H
 #define SPHERE_HEADER_H
 
+#include "BVH.hpp"
 #include "HitRecord.hpp"
+#include "Primitive.hpp"
 #include "Ray.hpp"
 #include "Vec3.hpp"
 
 #include <iostream>
 
 // Sphere class.
-class Sphere
+class Sphere : public Primitive
 {
 public:
     Vec3 center;
-    double radius;
-    Vec3 color;
-    Material *material;
+    Real radius;
     Sphere() {}
-    Sphere(Vec3 c, double r, Vec3 col, Material *m) : center(c), radius(r), color(col), material(m) {}
-    // Determine whether the ray hits the sphere, and store the hit point,
-    // hit distance, normal, and front face in the hit record.
-    bool hit(const Ray &ray, HitRecord &rec, double tmin = -0.001, double tmax = 0.001) const
+    Sphere(Vec3 c, Real r, Vec3 col, int m) : Primitive(col, m), center(c), radius(r) {}
+
+    // Bounding box of the sphere.
+    AABB bounds() const
+    {
+        const Vec3 r(std::fabs(radius), std::fabs(radius), std::fabs(radius));
+        return AABB(center - r, center + r);
+    }
+
+    // Determine whether the ray hits the sphere within [tmin, tmax], and
+    // if so lower tmax to the hit distance.
+    bool intersect(const Ray &ray, Real tmin, Real &tmax) const
     {
 
         // Ray-sphere intersection equation.
         Vec3 oc = ray.orig - center;
-        double a = ray.dir.length_squared();
-        double b = dot(oc, ray.dir);
-        double c = oc.length_squared() - radius * radius;
-        double discriminant = b * b - a * c;
+        Real a = ray.dir.length_squared();
+        Real b = dot(oc, ray.dir);
+        Real c = oc.length_squared() - radius * radius;
+        Real discriminant = b * b - a * c;
 
         if (discriminant < 0)
         {
@@ -36,10 +44,10 @@ public:
         else
         {
             // Find the nearest root that lies in the range.
-            double temp = (-b - sqrt(discriminant)) / a;
+            Real temp = (-b - std::sqrt(discriminant)) / a;
             if (temp > tmax || temp < tmin)
             {
-                temp = (-b + sqrt(discriminant)) / a;
+                temp = (-b + std::sqrt(discriminant)) / a;
             }
             if (temp > tmax || temp < tmin)
             {
@@ -47,16 +55,38 @@ public:
             }
             else
             {
-                rec.t = temp;
-                rec.p = ray.at(rec.t);
-                Vec3 out_N = (rec.p - center) / radius;
-                rec.front = dot(ray.dir, out_N) < 0;
-                rec.normal = rec.front ? out_N : -out_N;
-                GetSphereUV((rec.p - center) / radius, rec.u, rec.v);
+                tmax = temp;
                 return true;
             }
         }
     }
+
+    // Store the hit point, hit distance, normal, front face and texture
+    // coordinates of the hit at distance t in the hit record.
+    void interact(const Ray &ray, Real t, HitRecord &rec) const
+    {
+        rec.t = t;
+        rec.p = ray.at(rec.t);
+        Vec3 out_N = (rec.p - center) / radius;
+        rec.front = dot(ray.dir, out_N) < 0;
+        rec.normal = rec.front ? out_N : -out_N;
+        GetSphereUV((rec.p - center) / radius, rec.u, rec.v);
+        // u wraps the full circumference and v runs pole to pole.
+        rec.width = ray.width + ray.spread * rec.t * ray.dir.length();
+        rec.du = rec.width / (2 * pi * std::fabs(radius));
+        rec.dv = rec.width / (pi * std::fabs(radius));
+        rec.curvature = 1 / std::fabs(radius);
+    }
+
+    // Determine whether the ray hits the sphere, and store the hit point,
+    // hit distance, normal, and front face in the hit record.
+    bool hit(const Ray &ray, HitRecord &rec, Real tmin = -0.001, Real tmax = 0.001) const
+    {
+        if (!intersect(ray, tmin, tmax))
+            return false;
+        interact(ray, tmax, rec);
+        return true;
+    }
 };
 
 #endif
\ No newline at end of file
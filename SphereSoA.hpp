@@ -0,0 +1,375 @@
+#ifndef SPHERESOA_HEADER_H
+#define SPHERESOA_HEADER_H
+
+#include "Ray.hpp"
+#include "Sphere.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RT_X86 1
+#include <immintrin.h>
+#endif
+
+// Intersection kernel: nearest sphere in [first, end) hit within [tmin, tmax].
+// Returns its index and stores the distance in tmax, or returns -1.
+// Every kernel comes in float and double flavours; the renderer uses the
+// one matching Real.
+typedef int (*SphereKernel)(const Real *cx, const Real *cy, const Real *cz,
+                            const Real *r2, const Ray &ray, int first, int end,
+                            Real tmin, Real &tmax);
+
+// Scalar kernel. Same arithmetic as Sphere::hit, one sphere at a time.
+template <typename T>
+inline int IntersectSpheresScalar(const T *cx, const T *cy, const T *cz,
+                                  const T *r2, const Ray &ray, int first, int end,
+                                  T tmin, T &tmax)
+{
+    const T a = ray.dir.length_squared();
+    int best = -1;
+    for (int i = first; i < end; i++)
+    {
+        const T ocx = ray.orig.x - cx[i];
+        const T ocy = ray.orig.y - cy[i];
+        const T ocz = ray.orig.z - cz[i];
+        const T b = ocx * ray.dir.x + ocy * ray.dir.y + ocz * ray.dir.z;
+        const T c = (ocx * ocx + ocy * ocy + ocz * ocz) - r2[i];
+        const T discriminant = b * b - a * c;
+        if (discriminant < 0)
+            continue;
+        const T sq = std::sqrt(discriminant);
+        T t = (-b - sq) / a;
+        if (t > tmax || t < tmin)
+            t = (-b + sq) / a;
+        if (t > tmax || t < tmin)
+            continue;
+        tmax = t;
+        best = i;
+    }
+    return best;
+};
+
+#ifdef RT_X86
+
+// SSE4.1 kernel for double geometry, two spheres per instruction.
+__attribute__((target("sse4.1"))) inline int IntersectSpheresSSE(
+    const double *cx, const double *cy, const double *cz, const double *r2,
+    const Ray &ray, int first, int end, double tmin, double &tmax)
+{
+    const __m128d ox = _mm_set1_pd(ray.orig.x), oy = _mm_set1_pd(ray.orig.y), oz = _mm_set1_pd(ray.orig.z);
+    const __m128d dx = _mm_set1_pd(ray.dir.x), dy = _mm_set1_pd(ray.dir.y), dz = _mm_set1_pd(ray.dir.z);
+    const __m128d a = _mm_set1_pd(ray.dir.length_squared());
+    const __m128d vtmin = _mm_set1_pd(tmin), vtmax = _mm_set1_pd(tmax);
+    const __m128d vend = _mm_set1_pd(end);
+    const __m128d sign = _mm_set1_pd(-0.0);
+    const __m128d step = _mm_set1_pd(2.0);
+
+    __m128d best_t = vtmax;
+    __m128d best_i = _mm_set1_pd(-1.0);
+    __m128d idx = _mm_set_pd(first + 1, first);
+    for (int i = first; i < end; i += 2)
+    {
+        const __m128d ocx = _mm_sub_pd(ox, _mm_loadu_pd(cx + i));
+        const __m128d ocy = _mm_sub_pd(oy, _mm_loadu_pd(cy + i));
+        const __m128d ocz = _mm_sub_pd(oz, _mm_loadu_pd(cz + i));
+        const __m128d b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, dx), _mm_mul_pd(ocy, dy)), _mm_mul_pd(ocz, dz));
+        const __m128d oc2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz));
+        const __m128d c = _mm_sub_pd(oc2, _mm_loadu_pd(r2 + i));
+        const __m128d disc = _mm_sub_pd(_mm_mul_pd(b, b), _mm_mul_pd(a, c));
+        const __m128d sq = _mm_sqrt_pd(_mm_max_pd(disc, _mm_setzero_pd()));
+        const __m128d nb = _mm_xor_pd(b, sign);
+        const __m128d t0 = _mm_div_pd(_mm_sub_pd(nb, sq), a);
+        const __m128d t1 = _mm_div_pd(_mm_add_pd(nb, sq), a);
+        const __m128d in0 = _mm_and_pd(_mm_cmpge_pd(t0, vtmin), _mm_cmple_pd(t0, vtmax));
+        const __m128d in1 = _mm_and_pd(_mm_cmpge_pd(t1, vtmin), _mm_cmple_pd(t1, vtmax));
+        const __m128d t = _mm_blendv_pd(t1, t0, in0);
+        __m128d mask = _mm_and_pd(_mm_cmpge_pd(disc, _mm_setzero_pd()), _mm_or_pd(in0, in1));
+        mask = _mm_and_pd(mask, _mm_cmplt_pd(idx, vend));
+        mask = _mm_and_pd(mask, _mm_cmplt_pd(t, best_t));
+        best_t = _mm_blendv_pd(best_t, t, mask);
+        best_i = _mm_blendv_pd(best_i, idx, mask);
+        idx = _mm_add_pd(idx, step);
+    }
+
+    double ts[2], is[2];
+    _mm_storeu_pd(ts, best_t);
+    _mm_storeu_pd(is, best_i);
+    int best = -1;
+    for (int l = 0; l < 2; l++)
+    {
+        if (is[l] >= 0 && (best < 0 || ts[l] < tmax || (ts[l] == tmax && is[l] < best)))
+        {
+            tmax = ts[l];
+            best = static_cast<int>(is[l]);
+        }
+    }
+    return best;
+};
+
+// SSE4.1 kernel for float geometry, four spheres per instruction. Lane
+// indices are carried as floats, exact up to 2^24 spheres.
+__attribute__((target("sse4.1"))) inline int IntersectSpheresSSE(
+    const float *cx, const float *cy, const float *cz, const float *r2,
+    const Ray &ray, int first, int end, float tmin, float &tmax)
+{
+    const __m128 ox = _mm_set1_ps(ray.orig.x), oy = _mm_set1_ps(ray.orig.y), oz = _mm_set1_ps(ray.orig.z);
+    const __m128 dx = _mm_set1_ps(ray.dir.x), dy = _mm_set1_ps(ray.dir.y), dz = _mm_set1_ps(ray.dir.z);
+    const __m128 a = _mm_set1_ps(ray.dir.length_squared());
+    const __m128 vtmin = _mm_set1_ps(tmin), vtmax = _mm_set1_ps(tmax);
+    const __m128 vend = _mm_set1_ps(end);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 step = _mm_set1_ps(4.0f);
+
+    __m128 best_t = vtmax;
+    __m128 best_i = _mm_set1_ps(-1.0f);
+    __m128 idx = _mm_set_ps(first + 3, first + 2, first + 1, first);
+    for (int i = first; i < end; i += 4)
+    {
+        const __m128 ocx = _mm_sub_ps(ox, _mm_loadu_ps(cx + i));
+        const __m128 ocy = _mm_sub_ps(oy, _mm_loadu_ps(cy + i));
+        const __m128 ocz = _mm_sub_ps(oz, _mm_loadu_ps(cz + i));
+        const __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+        const __m128 oc2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz));
+        const __m128 c = _mm_sub_ps(oc2, _mm_loadu_ps(r2 + i));
+        const __m128 disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(a, c));
+        const __m128 sq = _mm_sqrt_ps(_mm_max_ps(disc, _mm_setzero_ps()));
+        const __m128 nb = _mm_xor_ps(b, sign);
+        const __m128 t0 = _mm_div_ps(_mm_sub_ps(nb, sq), a);
+        const __m128 t1 = _mm_div_ps(_mm_add_ps(nb, sq), a);
+        const __m128 in0 = _mm_and_ps(_mm_cmpge_ps(t0, vtmin), _mm_cmple_ps(t0, vtmax));
+        const __m128 in1 = _mm_and_ps(_mm_cmpge_ps(t1, vtmin), _mm_cmple_ps(t1, vtmax));
+        const __m128 t = _mm_blendv_ps(t1, t0, in0);
+        __m128 mask = _mm_and_ps(_mm_cmpge_ps(disc, _mm_setzero_ps()), _mm_or_ps(in0, in1));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(idx, vend));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(t, best_t));
+        best_t = _mm_blendv_ps(best_t, t, mask);
+        best_i = _mm_blendv_ps(best_i, idx, mask);
+        idx = _mm_add_ps(idx, step);
+    }
+
+    float ts[4], is[4];
+    _mm_storeu_ps(ts, best_t);
+    _mm_storeu_ps(is, best_i);
+    int best = -1;
+    for (int l = 0; l < 4; l++)
+    {
+        if (is[l] >= 0 && (best < 0 || ts[l] < tmax || (ts[l] == tmax && is[l] < best)))
+        {
+            tmax = ts[l];
+            best = static_cast<int>(is[l]);
+        }
+    }
+    return best;
+};
+
+// AVX2 kernel for double geometry, four spheres per instruction.
+__attribute__((target("avx2"))) inline int IntersectSpheresAVX2(
+    const double *cx, const double *cy, const double *cz, const double *r2,
+    const Ray &ray, int first, int end, double tmin, double &tmax)
+{
+    const __m256d ox = _mm256_set1_pd(ray.orig.x), oy = _mm256_set1_pd(ray.orig.y), oz = _mm256_set1_pd(ray.orig.z);
+    const __m256d dx = _mm256_set1_pd(ray.dir.x), dy = _mm256_set1_pd(ray.dir.y), dz = _mm256_set1_pd(ray.dir.z);
+    const __m256d a = _mm256_set1_pd(ray.dir.length_squared());
+    const __m256d vtmin = _mm256_set1_pd(tmin), vtmax = _mm256_set1_pd(tmax);
+    const __m256d vend = _mm256_set1_pd(end);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d step = _mm256_set1_pd(4.0);
+
+    __m256d best_t = vtmax;
+    __m256d best_i = _mm256_set1_pd(-1.0);
+    __m256d idx = _mm256_set_pd(first + 3, first + 2, first + 1, first);
+    for (int i = first; i < end; i += 4)
+    {
+        const __m256d ocx = _mm256_sub_pd(ox, _mm256_loadu_pd(cx + i));
+        const __m256d ocy = _mm256_sub_pd(oy, _mm256_loadu_pd(cy + i));
+        const __m256d ocz = _mm256_sub_pd(oz, _mm256_loadu_pd(cz + i));
+        const __m256d b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+        const __m256d oc2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+        const __m256d c = _mm256_sub_pd(oc2, _mm256_loadu_pd(r2 + i));
+        const __m256d disc = _mm256_sub_pd(_mm256_mul_pd(b, b), _mm256_mul_pd(a, c));
+        const __m256d sq = _mm256_sqrt_pd(_mm256_max_pd(disc, _mm256_setzero_pd()));
+        const __m256d nb = _mm256_xor_pd(b, sign);
+        const __m256d t0 = _mm256_div_pd(_mm256_sub_pd(nb, sq), a);
+        const __m256d t1 = _mm256_div_pd(_mm256_add_pd(nb, sq), a);
+        const __m256d in0 = _mm256_and_pd(_mm256_cmp_pd(t0, vtmin, _CMP_GE_OQ), _mm256_cmp_pd(t0, vtmax, _CMP_LE_OQ));
+        const __m256d in1 = _mm256_and_pd(_mm256_cmp_pd(t1, vtmin, _CMP_GE_OQ), _mm256_cmp_pd(t1, vtmax, _CMP_LE_OQ));
+        const __m256d t = _mm256_blendv_pd(t1, t0, in0);
+        __m256d mask = _mm256_and_pd(_mm256_cmp_pd(disc, _mm256_setzero_pd(), _CMP_GE_OQ), _mm256_or_pd(in0, in1));
+        mask = _mm256_and_pd(mask, _mm256_cmp_pd(idx, vend, _CMP_LT_OQ));
+        mask = _mm256_and_pd(mask, _mm256_cmp_pd(t, best_t, _CMP_LT_OQ));
+        best_t = _mm256_blendv_pd(best_t, t, mask);
+        best_i = _mm256_blendv_pd(best_i, idx, mask);
+        idx = _mm256_add_pd(idx, step);
+    }
+
+    double ts[4], is[4];
+    _mm256_storeu_pd(ts, best_t);
+    _mm256_storeu_pd(is, best_i);
+    int best = -1;
+    for (int l = 0; l < 4; l++)
+    {
+        if (is[l] >= 0 && (best < 0 || ts[l] < tmax || (ts[l] == tmax && is[l] < best)))
+        {
+            tmax = ts[l];
+            best = static_cast<int>(is[l]);
+        }
+    }
+    return best;
+};
+
+// AVX2 kernel for float geometry, eight spheres per instruction.
+__attribute__((target("avx2"))) inline int IntersectSpheresAVX2(
+    const float *cx, const float *cy, const float *cz, const float *r2,
+    const Ray &ray, int first, int end, float tmin, float &tmax)
+{
+    const __m256 ox = _mm256_set1_ps(ray.orig.x), oy = _mm256_set1_ps(ray.orig.y), oz = _mm256_set1_ps(ray.orig.z);
+    const __m256 dx = _mm256_set1_ps(ray.dir.x), dy = _mm256_set1_ps(ray.dir.y), dz = _mm256_set1_ps(ray.dir.z);
+    const __m256 a = _mm256_set1_ps(ray.dir.length_squared());
+    const __m256 vtmin = _mm256_set1_ps(tmin), vtmax = _mm256_set1_ps(tmax);
+    const __m256 vend = _mm256_set1_ps(end);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 step = _mm256_set1_ps(8.0f);
+
+    __m256 best_t = vtmax;
+    __m256 best_i = _mm256_set1_ps(-1.0f);
+    __m256 idx = _mm256_set_ps(first + 7, first + 6, first + 5, first + 4, first + 3, first + 2, first + 1, first);
+    for (int i = first; i < end; i += 8)
+    {
+        const __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(cx + i));
+        const __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(cy + i));
+        const __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(cz + i));
+        const __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+        const __m256 oc2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz));
+        const __m256 c = _mm256_sub_ps(oc2, _mm256_loadu_ps(r2 + i));
+        const __m256 disc = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(a, c));
+        const __m256 sq = _mm256_sqrt_ps(_mm256_max_ps(disc, _mm256_setzero_ps()));
+        const __m256 nb = _mm256_xor_ps(b, sign);
+        const __m256 t0 = _mm256_div_ps(_mm256_sub_ps(nb, sq), a);
+        const __m256 t1 = _mm256_div_ps(_mm256_add_ps(nb, sq), a);
+        const __m256 in0 = _mm256_and_ps(_mm256_cmp_ps(t0, vtmin, _CMP_GE_OQ), _mm256_cmp_ps(t0, vtmax, _CMP_LE_OQ));
+        const __m256 in1 = _mm256_and_ps(_mm256_cmp_ps(t1, vtmin, _CMP_GE_OQ), _mm256_cmp_ps(t1, vtmax, _CMP_LE_OQ));
+        const __m256 t = _mm256_blendv_ps(t1, t0, in0);
+        __m256 mask = _mm256_and_ps(_mm256_cmp_ps(disc, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_or_ps(in0, in1));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(idx, vend, _CMP_LT_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, best_t, _CMP_LT_OQ));
+        best_t = _mm256_blendv_ps(best_t, t, mask);
+        best_i = _mm256_blendv_ps(best_i, idx, mask);
+        idx = _mm256_add_ps(idx, step);
+    }
+
+    float ts[8], is[8];
+    _mm256_storeu_ps(ts, best_t);
+    _mm256_storeu_ps(is, best_i);
+    int best = -1;
+    for (int l = 0; l < 8; l++)
+    {
+        if (is[l] >= 0 && (best < 0 || ts[l] < tmax || (ts[l] == tmax && is[l] < best)))
+        {
+            tmax = ts[l];
+            best = static_cast<int>(is[l]);
+        }
+    }
+    return best;
+};
+
+#endif
+
+// Pick the widest kernel the CPU supports, or the one named by isa
+// ("avx2", "sse4" or "scalar"). Unknown or unsupported names fall back.
+inline SphereKernel SelectSphereKernel(const char *isa = NULL)
+{
+#ifdef RT_X86
+    __builtin_cpu_init();
+    const bool avx2 = __builtin_cpu_supports("avx2");
+    const bool sse4 = __builtin_cpu_supports("sse4.1");
+    if (isa == NULL || !strcmp(isa, "avx2"))
+    {
+        if (avx2)
+            return IntersectSpheresAVX2;
+        if (sse4)
+            return IntersectSpheresSSE;
+    }
+    else if (!strcmp(isa, "sse4") && sse4)
+    {
+        return IntersectSpheresSSE;
+    }
+#endif
+    return IntersectSpheresScalar<Real>;
+};
+
+inline const char *SphereKernelName(SphereKernel kernel)
+{
+#ifdef RT_X86
+    if (kernel == static_cast<SphereKernel>(IntersectSpheresAVX2))
+        return "avx2";
+    if (kernel == static_cast<SphereKernel>(IntersectSpheresSSE))
+        return "sse4";
+#endif
+    return "scalar";
+};
+
+// Structure-of-arrays copy of the sphere geometry. Only what the
+// intersection test reads is kept, one 64-byte aligned array per field,
+// padded so the vector kernels may read past the last sphere.
+class SphereSoA
+{
+private:
+    static const int alignment = 64;
+    static const int padding = 8;
+
+    struct FreeDeleter
+    {
+        void operator()(Real *p) const { free(p); }
+    };
+    typedef std::unique_ptr<Real[], FreeDeleter> Array;
+
+    Array cx, cy, cz, r2;
+    int count = 0;
+
+    static Array allocate(int n)
+    {
+        size_t bytes = sizeof(Real) * (n + padding);
+        bytes = (bytes + alignment - 1) / alignment * alignment;
+        Real *p = static_cast<Real *>(aligned_alloc(alignment, bytes));
+        memset(p, 0, bytes);
+        return Array(p);
+    }
+
+public:
+    SphereKernel kernel = SelectSphereKernel();
+
+    // Copy the spheres. The arrays are reused while the count stays the
+    // same, as when an animated scene moves its spheres between frames.
+    void build(const std::vector<Sphere> &spheres)
+    {
+        if (!cx || count != static_cast<int>(spheres.size()))
+        {
+            count = static_cast<int>(spheres.size());
+            cx = allocate(count);
+            cy = allocate(count);
+            cz = allocate(count);
+            r2 = allocate(count);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            cx[i] = spheres[i].center.x;
+            cy[i] = spheres[i].center.y;
+            cz[i] = spheres[i].center.z;
+            r2[i] = spheres[i].radius * spheres[i].radius;
+        }
+    }
+
+    int size() const { return count; }
+
+    // Nearest sphere in [first, first + n) hit within [tmin, tmax], or -1.
+    int intersect(const Ray &ray, int first, int n, Real tmin, Real &tmax) const
+    {
+        return kernel(cx.get(), cy.get(), cz.get(), r2.get(), ray, first, first + n, tmin, tmax);
+    }
+};
+
+#endif
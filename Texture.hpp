@@ -9,7 +9,7 @@
 #pragma warning(push, 0)
 #endif
 
-#define STB_IMAGE_IMPLEMENTATION
+// The implementation is compiled once, in stb_image.cpp.
 #include "external/stb_image.h"
 
 // Restore warning levels.
@@ -18,102 +18,251 @@
 #pragma warning(pop)
 #endif
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <variant>
+#include <vector>
 
 using namespace std;
 
-// Base texture class.
-class Texture
-{
-public:
-    virtual Vec3 value(double u, double v, const Vec3 &p) const = 0;
-};
-
 // Constant texture class.
-class ConstantTexture : public Texture
+class ConstantTexture
 {
 public:
     Vec3 color;
     ConstantTexture() {}
     ConstantTexture(Vec3 c) : color(c) {}
-    virtual Vec3 value(double u, double v, const Vec3 &p) const override
+    Vec3 value(double u, double v, const Vec3 &p) const
     {
         return color;
     }
 };
 
-// Checker texture class.
-class CheckerTexture : public Texture
+// Checker texture class. The squares refer to other textures by their
+// index in the TextureTable.
+class CheckerTexture
 {
 public:
-    Texture *odd;
-    Texture *even;
+    int odd = -1;
+    int even = -1;
     CheckerTexture() {}
-    CheckerTexture(Texture *t0, Texture *t1) : even(t0), odd(t1) {}
-    virtual Vec3 value(double u, double v, const Vec3 &p) const override
+    CheckerTexture(int t0, int t1) : odd(t1), even(t0) {}
+    // Pick the texture for the square containing p. Squares are pi / 10
+    // wide along every axis, the cells where sin(10 p) changes sign, and
+    // are found by rounding down so that points lying exactly on a cell
+    // boundary, as on a floor at y = 0, fall consistently on one side.
+    int select(const Vec3 &p) const
     {
-        double sines = sin(10 * p.x) * sin(10 * p.y) * sin(10 * p.z);
-        if (sines < 0)
-            return odd->value(u, v, p);
+        const double scale = 10 / 3.1415926535897932385;
+        const long long cells = static_cast<long long>(floor(scale * p.x)) + static_cast<long long>(floor(scale * p.y)) +
+                                static_cast<long long>(floor(scale * p.z));
+        if (cells & 1)
+            return odd;
         else
-            return even->value(u, v, p);
+            return even;
     }
 };
 
-// Image texture class.
-class ImageTexture final : public Texture
+// Mip level of an image texture. Texels are stored in 8x8 tiles, each tile
+// contiguous in memory, so the texels around a lookup and those of nearby
+// rays tend to share cache lines regardless of direction.
+class MipLevel
 {
+public:
+    struct Texel
+    {
+        float r, g, b;
+    };
+
+    const static int tile_shift = 3;
+    const static int tile_size = 1 << tile_shift;
+    const static int tile_mask = tile_size - 1;
 
-private:
-    unsigned char *data = nullptr;
     int width = 0, height = 0;
-    int bytes_per_scanline = 0;
+
+private:
+    int tiles_x = 0;
+    vector<Texel> texels;
+
+    size_t offset(int x, int y) const
+    {
+        const size_t tile = static_cast<size_t>(y >> tile_shift) * tiles_x + (x >> tile_shift);
+        return (tile << (2 * tile_shift)) + ((y & tile_mask) << tile_shift) + (x & tile_mask);
+    }
+
+public:
+    MipLevel() {}
+    MipLevel(int w, int h) : width(w), height(h)
+    {
+        tiles_x = (w + tile_mask) >> tile_shift;
+        const int tiles_y = (h + tile_mask) >> tile_shift;
+        texels.resize(static_cast<size_t>(tiles_x) * tiles_y * tile_size * tile_size);
+    }
+
+    const Texel &at(int x, int y) const { return texels[offset(x, y)]; }
+    Texel &at(int x, int y) { return texels[offset(x, y)]; }
+
+    // Bilinear lookup. s wraps around, as sphere maps do at their seam, and
+    // t is clamped; both are in [0, 1] with t = 0 at the top row.
+    Vec3 bilinear(double s, double t) const
+    {
+        const double x = s * width - 0.5;
+        const double y = t * height - 0.5;
+        const double fx0 = floor(x), fy0 = floor(y);
+        const float fx = static_cast<float>(x - fx0);
+        const float fy = static_cast<float>(y - fy0);
+
+        int x0 = static_cast<int>(fx0) % width;
+        if (x0 < 0)
+            x0 += width;
+        const int x1 = x0 + 1 < width ? x0 + 1 : 0;
+        const int y0 = clamp(static_cast<int>(fy0), 0, height - 1);
+        const int y1 = clamp(static_cast<int>(fy0) + 1, 0, height - 1);
+
+        const Texel &a = at(x0, y0), &b = at(x1, y0);
+        const Texel &c = at(x0, y1), &d = at(x1, y1);
+        const float wa = (1 - fx) * (1 - fy), wb = fx * (1 - fy);
+        const float wc = (1 - fx) * fy, wd = fx * fy;
+        return Vec3(wa * a.r + wb * b.r + wc * c.r + wd * d.r,
+                    wa * a.g + wb * b.g + wc * c.g + wd * d.g,
+                    wa * a.b + wb * b.b + wc * c.b + wd * d.b);
+    }
+};
+
+// Image texture class. The image is converted to float texels once at load
+// time and kept as a mip pyramid; lookups are bilinear when the ray
+// footprint is at most a texel and trilinear between pyramid levels when
+// it is wider.
+class ImageTexture final
+{
+
+private:
+    vector<MipLevel> levels;
+
+    void build_pyramid()
+    {
+        while (levels.back().width > 1 || levels.back().height > 1)
+        {
+            const MipLevel &src = levels.back();
+            MipLevel dst(max(1, src.width / 2), max(1, src.height / 2));
+            for (int y = 0; y < dst.height; y++)
+            {
+                const int y0 = min(2 * y, src.height - 1), y1 = min(2 * y + 1, src.height - 1);
+                for (int x = 0; x < dst.width; x++)
+                {
+                    const int x0 = min(2 * x, src.width - 1), x1 = min(2 * x + 1, src.width - 1);
+                    const MipLevel::Texel &a = src.at(x0, y0), &b = src.at(x1, y0);
+                    const MipLevel::Texel &c = src.at(x0, y1), &d = src.at(x1, y1);
+                    dst.at(x, y) = MipLevel::Texel{0.25f * (a.r + b.r + c.r + d.r),
+                                                   0.25f * (a.g + b.g + c.g + d.g),
+                                                   0.25f * (a.b + b.b + c.b + d.b)};
+                }
+            }
+            levels.push_back(std::move(dst));
+        }
+    }
 
 public:
     const static int bytes_per_pixel = 3;
 
-    ~ImageTexture() { delete data; }
     ImageTexture() = default;
     ImageTexture(const char *filename)
     {
 
+        int width = 0, height = 0;
         int components_per_pixel = bytes_per_pixel;
 
-        data = stbi_load(filename, &width, &height, &components_per_pixel,
-                         components_per_pixel);
+        unsigned char *data = stbi_load(filename, &width, &height, &components_per_pixel,
+                                        components_per_pixel);
 
         if (!data)
         {
             cerr << "ERROR: Could not load texture image file '"
                  << filename << "'.\n";
-            width = height = 0;
+            return;
+        }
+
+        const float color_scale = 1.0f / 255.0f;
+        MipLevel base(width, height);
+        for (int y = 0; y < height; y++)
+        {
+            const unsigned char *row = data + static_cast<size_t>(y) * width * bytes_per_pixel;
+            for (int x = 0; x < width; x++)
+            {
+                const unsigned char *pixel = row + x * bytes_per_pixel;
+                base.at(x, y) = MipLevel::Texel{color_scale * pixel[0], color_scale * pixel[1],
+                                                color_scale * pixel[2]};
+            }
         }
+        stbi_image_free(data);
 
-        bytes_per_scanline = bytes_per_pixel * width;
+        levels.push_back(std::move(base));
+        build_pyramid();
     }
 
-    Vec3 value(double u, double v, const Vec3 &p) const override
+    // Look up the texture at (u, v). du and dv are the width of the ray
+    // footprint in texture space and pick the pyramid level.
+    Vec3 value(double u, double v, const Vec3 &p, double du = 0.0, double dv = 0.0) const
     {
 
-        if (data == nullptr)
+        if (levels.empty())
             return Vec3(0, 1, 1);
 
         u = clamp(u, 0.0, 1.0);
         v = 1.0 - clamp(v, 0.0, 1.0);
 
-        int i = static_cast<int>(u * width);
-        int j = static_cast<int>(v * height);
+        const MipLevel &base = levels[0];
+        const double texels = fmax(du * base.width, dv * base.height);
+        if (!(texels > 1.0))
+            return base.bilinear(u, v);
 
-        if (i >= width)
-            i = width - 1;
-        if (j >= height)
-            j = height - 1;
+        const double lod = log2(texels);
+        const int last = static_cast<int>(levels.size()) - 1;
+        if (lod >= last)
+            return levels[last].bilinear(u, v);
 
-        const double color_scale = 1.0 / 255.0;
-        const auto pixel = data + j * bytes_per_scanline + i * bytes_per_pixel;
+        const int level = static_cast<int>(lod);
+        const double f = lod - level;
+        return (1.0 - f) * levels[level].bilinear(u, v) + f * levels[level + 1].bilinear(u, v);
+    }
+};
+
+// Texture record: one of the texture kinds, tagged.
+typedef variant<ConstantTexture, CheckerTexture, ImageTexture> Texture;
+
+// Texture table. Every texture of a scene lives here, contiguously, and is
+// referred to by index; value() dispatches on the tag with a switch and
+// walks checker children in a loop rather than through virtual calls.
+class TextureTable
+{
+public:
+    vector<Texture> textures;
 
-        return Vec3(color_scale * pixel[0], color_scale * pixel[1],
-                    color_scale * pixel[2]);
+    int add(Texture t)
+    {
+        textures.push_back(std::move(t));
+        return static_cast<int>(textures.size()) - 1;
+    }
+
+    // Evaluate texture index at (u, v). du and dv are the ray footprint in
+    // texture space, used by image textures to filter.
+    Vec3 value(int index, double u, double v, const Vec3 &p, double du = 0.0, double dv = 0.0) const
+    {
+        while (true)
+        {
+            const Texture &t = textures[index];
+            switch (t.index())
+            {
+            case 0:
+                return get<ConstantTexture>(t).value(u, v, p);
+            case 1:
+                index = get<CheckerTexture>(t).select(p);
+                break;
+            default:
+                return get<ImageTexture>(t).value(u, v, p, du, dv);
+            }
+        }
     }
 };
 
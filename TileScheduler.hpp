@@ -0,0 +1,106 @@
+#ifndef TILESCHEDULER_HEADER_H
+#define TILESCHEDULER_HEADER_H
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Rectangular block of pixels [x0, x1) x [y0, y1).
+struct Tile
+{
+    int x0, y0;
+    int x1, y1;
+
+    int pixels() const { return (x1 - x0) * (y1 - y0); }
+};
+
+// Work-stealing tile scheduler. Every worker owns a queue holding a
+// contiguous run of tiles; it pops from the front of its own queue and,
+// once that is empty, steals from the back of the other workers' queues.
+class TileScheduler
+{
+private:
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::deque<Tile> tiles;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    int total = 0;
+
+public:
+    TileScheduler(int width, int height, int tilesize, int workers)
+        : TileScheduler(MakeTiles(width, height, tilesize), workers)
+    {
+    }
+
+    TileScheduler(const std::vector<Tile> &tiles, int workers)
+    {
+        total = static_cast<int>(tiles.size());
+
+        // Hand out contiguous runs so neighbouring tiles share cache lines
+        // in the scene data for as long as no stealing happens.
+        workers = std::max(workers, 1);
+        for (int w = 0; w < workers; w++)
+        {
+            queues.push_back(std::make_unique<WorkQueue>());
+            const size_t begin = tiles.size() * w / workers;
+            const size_t end = tiles.size() * (w + 1) / workers;
+            queues.back()->tiles.assign(tiles.begin() + begin, tiles.begin() + end);
+        }
+    }
+
+    // Cover the image with tiles in scanline order.
+    static std::vector<Tile> MakeTiles(int width, int height, int tilesize)
+    {
+        std::vector<Tile> tiles;
+        for (int y = 0; y < height; y += tilesize)
+        {
+            for (int x = 0; x < width; x += tilesize)
+            {
+                tiles.push_back(Tile{x, y, std::min(x + tilesize, width),
+                                     std::min(y + tilesize, height)});
+            }
+        }
+        return tiles;
+    }
+
+    int tile_count() const { return total; }
+
+    // Fetch the next tile for a worker. Returns false once every queue is empty.
+    bool next(int worker, Tile &tile)
+    {
+        const int n = static_cast<int>(queues.size());
+
+        // Own queue first.
+        {
+            WorkQueue &own = *queues[worker];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.tiles.empty())
+            {
+                tile = own.tiles.front();
+                own.tiles.pop_front();
+                return true;
+            }
+        }
+
+        // Steal from the back of the other queues.
+        for (int i = 1; i < n; i++)
+        {
+            WorkQueue &victim = *queues[(worker + i) % n];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tiles.empty())
+            {
+                tile = victim.tiles.back();
+                victim.tiles.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif
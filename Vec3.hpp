@@ -4,19 +4,34 @@
 #include <cmath>
 #include <iostream>
 
+// Scalar type of the renderer's geometry and colour math: double by
+// default, float when built with RT_FLOAT (make FLOAT=1).
+#ifdef RT_FLOAT
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
 // Vector class in 3D coordinates.
-class Vec3
+template <typename T>
+class Vec3T
 {
 public:
-    double x, y, z;
-    Vec3(double xx = 0.0, double yy = 0.0, double zz = 0.0) : x(xx), y(yy), z(zz) {}
+    T x, y, z;
+    constexpr Vec3T(T xx = 0, T yy = 0, T zz = 0) : x(xx), y(yy), z(zz) {}
 
-    Vec3 operator+(const double t) { return Vec3(x + t, y + t, z + t); }
-    Vec3 operator-(const double t) { return Vec3(x - t, y - t, z - t); }
-    Vec3 operator*(const double t) { return Vec3(x * t, y * t, z * t); }
-    Vec3 operator/(const double t) { return Vec3(x / t, y / t, z / t); }
+    // Conversion between precisions must be asked for.
+    template <typename U>
+    explicit constexpr Vec3T(const Vec3T<U> &v)
+        : x(static_cast<T>(v.x)), y(static_cast<T>(v.y)), z(static_cast<T>(v.z))
+    {
+    }
 
-    Vec3 &operator+=(const Vec3 &vec)
+    constexpr Vec3T operator+(const T t) const { return Vec3T(x + t, y + t, z + t); }
+    constexpr Vec3T operator-(const T t) const { return Vec3T(x - t, y - t, z - t); }
+    constexpr Vec3T operator/(const T t) const { return Vec3T(x / t, y / t, z / t); }
+
+    constexpr Vec3T &operator+=(const Vec3T &vec)
     {
         x += vec.x;
         y += vec.y;
@@ -24,84 +39,96 @@ public:
         return *this;
     }
 
-    Vec3 &operator+=(const double t)
+    constexpr Vec3T &operator+=(const T t)
     {
         x += t;
         y += t;
         z += t;
         return *this;
     }
-    Vec3 operator-() const { return Vec3(-x, -y, -z); }
-    Vec3 &operator*=(const double t)
+    constexpr Vec3T operator-() const { return Vec3T(-x, -y, -z); }
+    constexpr T operator[](int i) const { return i == 0 ? x : (i == 1 ? y : z); }
+    constexpr T &operator[](int i) { return i == 0 ? x : (i == 1 ? y : z); }
+    constexpr Vec3T &operator*=(const T t)
     {
         x *= t;
         y *= t;
         z *= t;
         return *this;
     }
-    Vec3 &operator/=(const double t)
+    constexpr Vec3T &operator/=(const T t)
     {
         return *this *= 1 / t;
     }
 
-    Vec3 operator+(const Vec3 &vec) const
+    constexpr Vec3T operator+(const Vec3T &vec) const
     {
-        return Vec3(x + vec.x, y + vec.y, z + vec.z);
+        return Vec3T(x + vec.x, y + vec.y, z + vec.z);
     }
 
-    Vec3 operator-(const Vec3 &vec) const
+    constexpr Vec3T operator-(const Vec3T &vec) const
     {
-        return Vec3(x - vec.x, y - vec.y, z - vec.z);
+        return Vec3T(x - vec.x, y - vec.y, z - vec.z);
     }
 
-    Vec3 operator*(const Vec3 &vec) const
+    constexpr Vec3T operator*(const Vec3T &vec) const
     {
-        return Vec3(x * vec.x, y * vec.y, z * vec.z);
+        return Vec3T(x * vec.x, y * vec.y, z * vec.z);
     }
 
-    double length() const
+    // Scaling takes the scalar in the vector's own precision, so double
+    // constants scale a float vector without promoting it.
+    friend constexpr Vec3T operator*(T t, const Vec3T &v)
     {
-        return sqrt(x * x + y * y + z * z);
+        return Vec3T(t * v.x, t * v.y, t * v.z);
     }
 
-    double length_squared() const
+    friend constexpr Vec3T operator*(const Vec3T &v, T t)
+    {
+        return t * v;
+    }
+
+    T length() const
+    {
+        return std::sqrt(x * x + y * y + z * z);
+    }
+
+    constexpr T length_squared() const
     {
         return x * x + y * y + z * z;
     }
 };
 
+// Vectors in the renderer's precision, and in double for scene descriptions.
+typedef Vec3T<Real> Vec3;
+typedef Vec3T<double> Vec3d;
+
 // Vec3 Utility Functions
 
-inline std::ostream &operator<<(std::ostream &out, const Vec3 &v)
+template <typename T>
+inline std::ostream &operator<<(std::ostream &out, const Vec3T<T> &v)
 {
     return out << v.x << ' ' << v.y << ' ' << v.z;
 };
 
-inline Vec3 operator*(double t, const Vec3 &v)
-{
-    return Vec3(t * v.x, t * v.y, t * v.z);
-};
-
-inline Vec3 operator*(const Vec3 &v, double t)
-{
-    return t * v;
-};
-
-inline double dot(const Vec3 &u, const Vec3 &v)
+template <typename T>
+constexpr T dot(const Vec3T<T> &u, const Vec3T<T> &v)
 {
     return u.x * v.x + u.y * v.y + u.z * v.z;
 };
 
-inline Vec3 cross(const Vec3 &u, const Vec3 &v)
+template <typename T>
+constexpr Vec3T<T> cross(const Vec3T<T> &u, const Vec3T<T> &v)
 {
-    return Vec3(u.y * v.z - u.z * v.y,
-                u.z * v.x - u.x * v.z,
-                u.x * v.y - u.y * v.x);
+    return Vec3T<T>(u.y * v.z - u.z * v.y,
+                    u.z * v.x - u.x * v.z,
+                    u.x * v.y - u.y * v.x);
 };
 
-inline Vec3 normalize(Vec3 v)
+template <typename T>
+inline Vec3T<T> normalize(Vec3T<T> v)
 {
     return v / v.length();
 };
 
-#endif
\ No newline at end of file
+#endif
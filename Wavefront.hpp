@@ -0,0 +1,227 @@
+#ifndef WAVEFRONT_HEADER_H
+#define WAVEFRONT_HEADER_H
+
+#include "HitRecord.hpp"
+#include "Material.hpp"
+#include "PathTracer.hpp"
+#include "Primitive.hpp"
+#include "Ray.hpp"
+#include "RenderStats.hpp"
+#include "Sampler.hpp"
+#include "Scene.hpp"
+#include "Vec3.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+// Wavefront path tracer. Instead of following one path to its end before
+// starting the next, a whole batch of paths advances one bounce at a time:
+// every ray is intersected, finished paths are compacted away, the
+// survivors are bucketed by material kind, and each kind's scatter runs
+// over its bucket in one go. Each path keeps its own sampler and is
+// scattered exactly as RayColor() would, so the radiance of every path is
+// the same as the depth-first integrator's.
+class Wavefront
+{
+private:
+    // A path in flight.
+    struct PathState
+    {
+        Ray ray;
+        Vec3 throughput;
+        Sampler sampler;
+        // Where the path's radiance goes when it ends.
+        int slot;
+        // Radiance gathered from lights sampled so far.
+        Vec3 radiance;
+        // Density of the ray's direction, as in RayColor().
+        Real bsdf_pdf;
+    };
+
+    const Scene &scene;
+    const PathSettings &settings;
+
+    std::vector<PathState> paths;
+    std::vector<HitRecord> records;
+    std::vector<const Primitive *> hits;
+    // Indices of the surviving paths, grouped by material kind.
+    std::vector<int> order;
+    std::vector<char> alive;
+    static const int kinds = std::variant_size<Material::Kind>::value;
+
+    // Scatter the paths in order[begin, end), all of whose materials are of
+    // kind K. Paths that are absorbed or lose the roulette are marked dead.
+    template <typename K>
+    void scatter(int begin, int end, int depth, Vec3 *radiance, PathStats &stats)
+    {
+        const MaterialLibrary &library = scene.library;
+        for (int o = begin; o < end; o++)
+        {
+            const int i = order[o];
+            PathState &path = paths[i];
+            const HitRecord &rec = records[i];
+            const Primitive &hit = *hits[i];
+            const Material &material = library.materials[hit.material];
+            const K &kind = std::get<K>(material.kind);
+
+            Ray scattered;
+            Vec3 attenuation;
+            RT_STAT(ThreadCounters.scatters[material.kind.index()]++);
+            path.sampler.start_bounce(depth);
+            bool ok;
+            if constexpr (std::is_same<K, Lambertian>::value)
+                ok = kind.scatter(path.ray, rec, scattered, attenuation, path.sampler, library.textures);
+            else
+                ok = kind.scatter(path.ray, rec, scattered, attenuation, path.sampler);
+            if (!ok)
+            {
+                RT_STAT(ThreadCounters.end_path(depth + 1, PathEnd::Absorbed));
+                radiance[path.slot] = path.radiance;
+                alive[i] = 0;
+                continue;
+            }
+            scattered.width = rec.width;
+            scattered.spread = path.ray.spread + 2 * rec.width * rec.curvature + material.spread();
+            const Vec3 reflectance = attenuation * hit.color;
+            path.bsdf_pdf = 0;
+            if (std::is_same<K, Lambertian>::value && settings.light_sampling)
+            {
+                path.radiance += path.throughput * SampleLight(scene, rec, reflectance, path.sampler, stats);
+                path.bsdf_pdf = std::fmax(Real(0), dot(normalize(scattered.dir), rec.normal)) / pi;
+            }
+            path.throughput = path.throughput * reflectance;
+            path.ray = scattered;
+
+            // Russian roulette, as in RayColor().
+            if (depth + 1 >= settings.rr_depth)
+            {
+                const Real p = std::fmax(path.throughput.x, std::fmax(path.throughput.y, path.throughput.z));
+                if (p < settings.rr_threshold)
+                {
+                    const Real survive = p / settings.rr_threshold;
+                    if (path.sampler.next_1d() >= survive)
+                    {
+                        stats.roulette++;
+                        stats.roulette_cut += settings.maxdepth - depth - 1;
+                        RT_STAT(ThreadCounters.end_path(depth + 1, PathEnd::Roulette));
+                        radiance[path.slot] = path.radiance;
+                        alive[i] = 0;
+                        continue;
+                    }
+                    path.throughput /= survive;
+                }
+            }
+        }
+    }
+
+    // Keep the paths still alive, in their current order.
+    void compact()
+    {
+        int n = 0;
+        for (size_t i = 0; i < paths.size(); i++)
+        {
+            if (!alive[i])
+                continue;
+            paths[n] = paths[i];
+            records[n] = records[i];
+            hits[n] = hits[i];
+            n++;
+        }
+        paths.erase(paths.begin() + n, paths.end());
+        records.resize(n);
+        hits.resize(n);
+    }
+
+public:
+    Wavefront(const Scene &s, const PathSettings &p) : scene(s), settings(p) {}
+
+    // Queue a camera ray. sampler is the path's sampler after generating the ray.
+    void add(const Ray &ray, const Sampler &sampler, int slot)
+    {
+        paths.push_back(PathState{ray, Vec3(1, 1, 1), sampler, slot, Vec3(), 0});
+    }
+
+    size_t size() const { return paths.size(); }
+
+    // Trace every queued path to its end and store its radiance in
+    // radiance[slot], and if first is given its camera ray's hit in
+    // first[slot].
+    void trace(Vec3 *radiance, PathStats &stats, FirstHit *first = NULL)
+    {
+        stats.paths += paths.size();
+        for (int depth = 0; depth < settings.maxdepth && !paths.empty(); depth++)
+        {
+            const size_t n = paths.size();
+            stats.segments += n;
+            records.resize(n);
+            hits.resize(n);
+            alive.assign(n, 1);
+
+            // Intersect every ray, then end the paths that escaped or hit
+            // an emitter. Only the paths that hit something have their
+            // surface evaluated.
+            for (size_t i = 0; i < n; i++)
+            {
+                PathState &path = paths[i];
+                RT_STAT(depth == 0 ? ThreadCounters.primary_rays++ : ThreadCounters.secondary_rays++);
+                Hit closest;
+                if (!scene.intersect(path.ray, 0.001, INFINITY, closest))
+                {
+                    RT_STAT(ThreadCounters.end_path(depth + 1, PathEnd::Escaped));
+                    Vec3 unitvec = normalize(path.ray.dir);
+                    const Real temp = 0.5 * ((unitvec.y) + 1.0);
+                    radiance[path.slot] = path.radiance + path.throughput * (temp * Vec3(0, 0, 0));
+                    alive[i] = 0;
+                    continue;
+                }
+                const Primitive *hit = scene.interact(path.ray, closest, records[i]);
+                hits[i] = hit;
+                if (depth == 0 && first)
+                    first[path.slot].record(path.ray, *hit, records[i], scene.library);
+                const Material &material = scene.library.materials[hit->material];
+                if (material.emits())
+                {
+                    RT_STAT(ThreadCounters.end_path(depth + 1, PathEnd::Emitted));
+                    const Real weight = EmissionWeight(scene, *hit, path.ray, records[i], path.bsdf_pdf);
+                    radiance[path.slot] = path.radiance + path.throughput * weight * material.emitted() * hit->color;
+                    alive[i] = 0;
+                }
+            }
+            compact();
+
+            // Bucket the survivors by material kind with a counting sort.
+            int start[kinds + 1] = {};
+            for (const Primitive *h : hits)
+                start[scene.library.materials[h->material].kind.index() + 1]++;
+            for (int k = 0; k < kinds; k++)
+                start[k + 1] += start[k];
+            order.resize(paths.size());
+            int fill[kinds];
+            std::copy(start, start + kinds, fill);
+            for (size_t i = 0; i < paths.size(); i++)
+                order[fill[scene.library.materials[hits[i]->material].kind.index()]++] = static_cast<int>(i);
+
+            // Run each scatter kernel over its bucket. Emitters have ended
+            // their paths, so the emissive bucket is empty.
+            alive.assign(paths.size(), 1);
+            scatter<Lambertian>(start[0], start[1], depth, radiance, stats);
+            scatter<Metal>(start[1], start[2], depth, radiance, stats);
+            scatter<Dielectric>(start[2], start[3], depth, radiance, stats);
+            compact();
+        }
+
+        // Paths still going have used up the depth budget.
+        for (const PathState &path : paths)
+        {
+            RT_STAT(ThreadCounters.end_path(settings.maxdepth, PathEnd::MaxDepth));
+            radiance[path.slot] = path.radiance;
+        }
+        paths.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,453 @@
+#include "Box.hpp"
+#include "Camera.hpp"
+#include "DefaultScene.hpp"
+#include "HitRecord.hpp"
+#include "Material.hpp"
+#include "MaterialLibrary.hpp"
+#include "Mesh.hpp"
+#include "ObjLoader.hpp"
+#include "PathTracer.hpp"
+#include "Plane.hpp"
+#include "Random.hpp"
+#include "Ray.hpp"
+#include "Sampler.hpp"
+#include "Scene.hpp"
+#include "SceneFile.hpp"
+#include "Sphere.hpp"
+#include "SphereSoA.hpp"
+#include "Texture.hpp"
+#include "Vec3.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Microbenchmarks of the core kernels plus an end-to-end render of the
+// built-in scene. Results are written as JSON so runs of different versions
+// can be compared.
+
+// Inputs are drawn from pools of this size, cycled through by index, so the
+// timings cover the kernel and not the generation of its arguments.
+const int pool_size = 1024;
+const int pool_mask = pool_size - 1;
+
+// Every benchmark folds its results into this so none of the work is dropped.
+volatile double sink;
+
+// Benchmark settings.
+struct BenchSettings
+{
+    // Each timed run lasts at least this long...
+    double min_time = 0.1;
+    // ...and the reported time is the median of this many runs.
+    int repeats = 5;
+    // Only run benchmarks whose name contains this.
+    const char *filter = NULL;
+    // End-to-end render size and samples per pixel.
+    int width = 160;
+    int height = 80;
+    int spp = 4;
+};
+
+// Timing of one benchmark.
+struct BenchResult
+{
+    string name;
+    uint64_t iterations;
+    double ns_median;
+    double ns_min;
+};
+
+// Time body(n), which runs n operations and returns a checksum. n is doubled
+// until one run takes min_time; then repeats runs are timed at that n.
+template <typename F>
+void Measure(vector<BenchResult> &results, const BenchSettings &settings, const char *name, F body)
+{
+    if (settings.filter != NULL && strstr(name, settings.filter) == NULL)
+        return;
+
+    auto run = [&](uint64_t n) {
+        const auto start = chrono::steady_clock::now();
+        sink = sink + body(n);
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+
+    uint64_t n = 1;
+    while (run(n) < settings.min_time && n < (1ULL << 40))
+        n *= 2;
+
+    vector<double> times;
+    for (int r = 0; r < settings.repeats; r++)
+        times.push_back(run(n) * 1e9 / n);
+    sort(times.begin(), times.end());
+
+    results.push_back(BenchResult{name, n, times[times.size() / 2], times[0]});
+    fprintf(stderr, "%-32s %10.2f ns/op\n", name, results.back().ns_median);
+};
+
+// Rays from a shell around the unit sphere at the origin, aimed through the
+// sphere when hit is set and past it otherwise.
+vector<Ray> MakeSphereRays(Rng &rng, bool hit)
+{
+    vector<Ray> rays;
+    for (int i = 0; i < pool_size; i++)
+    {
+        const Vec3 origin = 5 * RandUnitVec(rng);
+        Vec3 target = 0.5 * RandVecInUnitSphere(rng);
+        if (!hit)
+            target = 2 * RandUnitVec(rng) + normalize(cross(origin, RandUnitVec(rng)));
+        rays.push_back(Ray(origin, target - origin));
+    }
+    return rays;
+};
+
+// Hits on the unit sphere with the rays that made them.
+void MakeSphereHits(Rng &rng, vector<Ray> &rays, vector<HitRecord> &records)
+{
+    const Sphere sphere(Vec3(), 1, Vec3(1, 1, 1), 0);
+    for (const Ray &ray : MakeSphereRays(rng, true))
+    {
+        HitRecord rec;
+        if (sphere.hit(ray, rec, 0.001, INFINITY))
+        {
+            rays.push_back(ray);
+            records.push_back(rec);
+        }
+    }
+    while (rays.size() < pool_size)
+    {
+        rays.push_back(rays[rays.size() % 16]);
+        records.push_back(records[records.size() % 16]);
+    }
+};
+
+// Render the built-in scene on one thread and report the rate at which rays
+// are traced. Every ray segment of a path counts as one ray.
+void RenderBenchmark(const BenchSettings &settings, FILE *out)
+{
+    SceneDescription desc = SetUpScene();
+    const int width = settings.width;
+    const int height = settings.height;
+    PathSettings path;
+    path.maxdepth = desc.maxdepth;
+
+    Scene scene;
+    BuildScene(desc, scene);
+    scene.soa.kernel = SelectSphereKernel();
+    scene.build();
+
+    const SceneDescription::CameraDesc &view = desc.camera;
+    Camera cam(view.eye, view.lookat, view.up, view.vfov, static_cast<double>(width) / height,
+               view.aperture, view.focusdist);
+    cam.set_resolution(height);
+
+    SamplerSettings sampling;
+    sampling.setup(SamplerSettings().type, width, height, settings.spp);
+
+    PathStats stats;
+    Vec3 sum;
+    const auto start = chrono::steady_clock::now();
+    for (int j = 0; j < height; j++)
+    {
+        for (int i = 0; i < width; i++)
+        {
+            for (int s = 0; s < settings.spp; s++)
+            {
+                Sampler sampler(sampling, i, j, s);
+                double du, dv;
+                sampler.next_2d(du, dv);
+                const double u = (i + du) / width;
+                const double v = (j + dv) / height;
+                sum += RayColor(cam.get_ray(u, v, sampler), scene, path, sampler, stats);
+            }
+        }
+    }
+    const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "%-32s %10.0f rays/s\n", "render", stats.segments / seconds);
+
+    fprintf(out, "  \"render\": {\"scene\": \"default\", \"width\": %d, \"height\": %d, \"spp\": %d, "
+                 "\"seconds\": %.6f, \"paths\": %llu, \"rays\": %llu, \"rays_per_second\": %.1f, "
+                 "\"checksum\": %.17g}\n",
+            width, height, settings.spp, seconds, (unsigned long long)stats.paths,
+            (unsigned long long)stats.segments, stats.segments / seconds, sum.x + sum.y + sum.z);
+};
+
+// Main function.
+int main(int argc, char **argv)
+{
+    // Parse command line options.
+    BenchSettings settings;
+    const char *outfile = NULL;
+    bool render = true;
+    for (int a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "--filter") && a + 1 < argc)
+            settings.filter = argv[++a];
+        else if (!strcmp(argv[a], "--min-time") && a + 1 < argc)
+            settings.min_time = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--repeats") && a + 1 < argc)
+            settings.repeats = max(1, atoi(argv[++a]));
+        else if (!strcmp(argv[a], "--size") && a + 2 < argc)
+        {
+            settings.width = max(1, atoi(argv[++a]));
+            settings.height = max(1, atoi(argv[++a]));
+        }
+        else if (!strcmp(argv[a], "--spp") && a + 1 < argc)
+            settings.spp = max(1, atoi(argv[++a]));
+        else if (!strcmp(argv[a], "--no-render"))
+            render = false;
+        else if ((!strcmp(argv[a], "-o") || !strcmp(argv[a], "--output")) && a + 1 < argc)
+            outfile = argv[++a];
+        else
+        {
+            fprintf(stderr, "Usage: %s [--filter TEXT] [--min-time SECONDS] [--repeats N]\n"
+                            "          [--size W H] [--spp N] [--no-render] [-o FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    vector<BenchResult> results;
+    Rng rng(12345);
+
+    // Sphere intersection.
+    {
+        const Sphere sphere(Vec3(), 1, Vec3(1, 1, 1), 0);
+        const vector<Ray> hits = MakeSphereRays(rng, true);
+        const vector<Ray> misses = MakeSphereRays(rng, false);
+        for (int k = 0; k < 2; k++)
+        {
+            const vector<Ray> &rays = k == 0 ? hits : misses;
+            Measure(results, settings, k == 0 ? "sphere_hit/hit" : "sphere_hit/miss", [&](uint64_t n) {
+                HitRecord rec;
+                double sum = 0;
+                for (uint64_t i = 0; i < n; i++)
+                    sum += sphere.hit(rays[i & pool_mask], rec, 0.001, INFINITY) ? rec.t : 1.0;
+                return sum;
+            });
+        }
+
+        // The lean test that candidates get, with no surface evaluated.
+        Measure(results, settings, "sphere_intersect/hit", [&](uint64_t n) {
+            double sum = 0;
+            for (uint64_t i = 0; i < n; i++)
+            {
+                Real t = INFINITY;
+                sum += sphere.intersect(hits[i & pool_mask], 0.001, t) ? t : 1.0;
+            }
+            return sum;
+        });
+
+        // The same rays against a plane through the sphere's centre, which
+        // half of them hit, and a box just inside the sphere.
+        const Plane plane(1, 0, Vec3(1, 1, 1), 0);
+        Measure(results, settings, "plane_hit", [&](uint64_t n) {
+            HitRecord rec;
+            double sum = 0;
+            for (uint64_t i = 0; i < n; i++)
+                sum += plane.hit(hits[i & pool_mask], rec, 0.001, INFINITY) ? rec.t : 1.0;
+            return sum;
+        });
+        const Box box(Vec3(-0.5, -0.5, -0.5), Vec3(0.5, 0.5, 0.5), Vec3(1, 1, 1), 0);
+        Measure(results, settings, "box_hit", [&](uint64_t n) {
+            HitRecord rec;
+            double sum = 0;
+            for (uint64_t i = 0; i < n; i++)
+                sum += box.hit(hits[i & pool_mask], rec, 0.001, INFINITY) ? rec.t : 1.0;
+            return sum;
+        });
+
+        // And against the torus mesh, through its hierarchy.
+        Mesh torus(Vec3(1, 1, 1), 0);
+        if (LoadObj("scenes/torus.obj", torus))
+        {
+            torus.build();
+            Measure(results, settings, "mesh_hit/torus", [&](uint64_t n) {
+                HitRecord rec;
+                double sum = 0;
+                for (uint64_t i = 0; i < n; i++)
+                {
+                    const Ray &ray = hits[i & pool_mask];
+                    Real t = INFINITY;
+                    const int triangle = torus.intersect(ray, 0.001, t);
+                    if (triangle >= 0)
+                        torus.interact(ray, t, triangle, rec);
+                    sum += triangle >= 0 ? rec.t : 1.0;
+                }
+                return sum;
+            });
+        }
+    }
+
+    // Materials and textures, evaluated at points on the unit sphere.
+    {
+        vector<Ray> rays;
+        vector<HitRecord> records;
+        MakeSphereHits(rng, rays, records);
+
+        MaterialLibrary library;
+        const int gray = library.constant(Vec3(0.5, 0.5, 0.5));
+        const int checker = library.checker(gray, library.constant(Vec3()));
+        const int image = library.image("earth.jpeg");
+
+        const struct
+        {
+            const char *name;
+            int material;
+        } materials[] = {
+            {"material_scatter/lambertian", library.lambertian(gray)},
+            {"material_scatter/metal", library.metal(Vec3(1, 1, 1), 0.1)},
+            {"material_scatter/dielectric", library.dielectric(1.5)},
+        };
+        for (const auto &m : materials)
+        {
+            const Material &material = library.materials[m.material];
+            Measure(results, settings, m.name, [&](uint64_t n) {
+                SamplerSettings sampling;
+                sampling.setup(SamplerType::Random, 1, 1, 1);
+                Sampler local(sampling, 0, 0, 0);
+                Ray scattered;
+                Vec3 attenuation;
+                double sum = 0;
+                for (uint64_t i = 0; i < n; i++)
+                {
+                    material.scatter(rays[i & pool_mask], records[i & pool_mask], scattered, attenuation, local,
+                                     library.textures);
+                    sum += scattered.dir.x + attenuation.x;
+                }
+                return sum;
+            });
+        }
+
+        // A footprint of a few texels makes image lookups trilinear.
+        const double footprint = 4.0 / 1024;
+        const struct
+        {
+            const char *name;
+            int texture;
+            double du;
+        } textures[] = {
+            {"texture_value/constant", gray, 0.0},
+            {"texture_value/checker", checker, 0.0},
+            {"texture_value/image_bilinear", image, 0.0},
+            {"texture_value/image_trilinear", image, footprint},
+        };
+        for (const auto &t : textures)
+        {
+            Measure(results, settings, t.name, [&](uint64_t n) {
+                double sum = 0;
+                for (uint64_t i = 0; i < n; i++)
+                {
+                    const HitRecord &rec = records[i & pool_mask];
+                    sum += library.textures.value(t.texture, rec.u, rec.v, rec.p, t.du, 2 * t.du).x;
+                }
+                return sum;
+            });
+        }
+    }
+
+    // Camera rays, with a lens so the aperture is sampled too.
+    {
+        Camera cam(Vec3d(0, 0, 5), Vec3d(), Vec3d(0, 1, 0), 60, 2.0, 0.1, 5);
+        cam.set_resolution(512);
+        Measure(results, settings, "camera_get_ray", [&](uint64_t n) {
+            SamplerSettings sampling;
+            sampling.setup(SamplerType::Random, 1, 1, 1);
+            Sampler local(sampling, 0, 0, 0);
+            double sum = 0;
+            for (uint64_t i = 0; i < n; i++)
+            {
+                const double u = (i & pool_mask) * (1.0 / pool_size);
+                sum += cam.get_ray(u, 1.0 - u, local).dir.x;
+            }
+            return sum;
+        });
+    }
+
+    // Random directions and sphere coordinates.
+    {
+        Measure(results, settings, "rand_unit_vec", [&](uint64_t n) {
+            Rng local(3);
+            double sum = 0;
+            for (uint64_t i = 0; i < n; i++)
+                sum += RandUnitVec(local).x;
+            return sum;
+        });
+        Measure(results, settings, "rand_vec_in_unit_sphere", [&](uint64_t n) {
+            Rng local(4);
+            double sum = 0;
+            for (uint64_t i = 0; i < n; i++)
+                sum += RandVecInUnitSphere(local).x;
+            return sum;
+        });
+
+        // A sample's first bounce: its pixel jitter, lens and bounce
+        // direction, for a 64-sample pixel of a 512 x 512 image.
+        for (SamplerType type : {SamplerType::Random, SamplerType::Stratified, SamplerType::Sobol,
+                                 SamplerType::BlueNoise})
+        {
+            SamplerSettings sampling;
+            sampling.setup(type, 512, 512, 64);
+            Measure(results, settings, ("sampler/" + string(SamplerName(type))).c_str(), [&](uint64_t n) {
+                double sum = 0, u, v;
+                for (uint64_t i = 0; i < n; i++)
+                {
+                    Sampler sampler(sampling, (i >> 6) & 511, (i >> 15) & 511, i & 63);
+                    for (int d = 0; d < 3; d++)
+                    {
+                        sampler.next_2d(u, v);
+                        sum += u + v;
+                    }
+                }
+                return sum;
+            });
+        }
+
+        vector<Vec3> points;
+        for (int i = 0; i < pool_size; i++)
+            points.push_back(RandUnitVec(rng));
+        Measure(results, settings, "get_sphere_uv", [&](uint64_t n) {
+            double sum = 0;
+            Real u, v;
+            for (uint64_t i = 0; i < n; i++)
+            {
+                GetSphereUV(points[i & pool_mask], u, v);
+                sum += u + v;
+            }
+            return sum;
+        });
+    }
+
+    FILE *out = stdout;
+    if (outfile != NULL && (out = fopen(outfile, "w")) == NULL)
+    {
+        fprintf(stderr, "ERROR: Could not open '%s' for writing.\n", outfile);
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"compiler\": \"%s\",\n  \"precision\": \"%s\",\n  \"sphere_kernel\": \"%s\",\n"
+                 "  \"benchmarks\": [\n",
+            __VERSION__, sizeof(Real) == sizeof(float) ? "float" : "double", SphereKernelName(SelectSphereKernel()));
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, \"ns_per_op_min\": %.3f}%s\n",
+                r.name.c_str(), (unsigned long long)r.iterations, r.ns_median, r.ns_min,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]%s\n", render ? "," : "");
+    if (render)
+        RenderBenchmark(settings, out);
+    fprintf(out, "}\n");
+
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -1,194 +1,275 @@
-#include "Camera.hpp"
-#include "HitRecord.hpp"
-#include "Material.hpp"
-#include "Ray.hpp"
-#include "Sphere.hpp"
-#include "Vec3.hpp"
-#include "utils.hpp"
+#include "Adaptive.hpp"
+#include "ImageIO.hpp"
+#include "Preview.hpp"
+#include "Renderer.hpp"
+#include "Sampler.hpp"
 
-#include <cmath>
-#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 #include <vector>
 
 using namespace std;
 
-// Define global color vectors.
-Vec3 WHITE = Vec3(1, 1, 1);
-Vec3 WHITEGRAY = Vec3(0.9, 0.9, 0.9);
-Vec3 GRAY = Vec3(0.5, 0.5, 0.5);
-Vec3 SILVER = Vec3(0.75, 0.75, 0.75);
-Vec3 BLACK = Vec3();
-Vec3 BLUE = Vec3(0, 0.75, 1);
-Vec3 PURPLE = Vec3(0.5, 0, 1.0);
-
-// Set up the scence.
-vector<Sphere> SetUpScene()
+// Main function. The command line front end of the renderer: it turns the
+// options into render settings, renders the frames asked for, and writes
+// the images, previews and statistics.
+int main(int argc, char **argv)
 {
-    // Load image textures.
-    ImageTexture *earth = new ImageTexture("earth.jpeg");
-    ImageTexture *mars = new ImageTexture("mars.jpeg");
-    ImageTexture *moon = new ImageTexture("moon.jpeg");
-
-    // Build the scene.
-    vector<Sphere> spheres = {
-        Sphere(Vec3(50, -1e12, 0), 1e12, GRAY, new Lambertian(new CheckerTexture(new ConstantTexture(GRAY), new ConstantTexture(BLACK)))),
-        Sphere(Vec3(50, 1e12 + 25, 0), 1e12, WHITEGRAY, NULL),
-        Sphere(Vec3(-1e12, 0, 0), 1e12, PURPLE, new Metal(Vec3(1, 1, 1), 0.8)),
-        Sphere(Vec3(1e12 + 100, 0, 0), 1e12, PURPLE, new Metal(Vec3(1, 1, 1), 0.8)),
-        Sphere(Vec3(0, 0, -1e12 - 50), 1e12, PURPLE, new Metal(Vec3(1, 1, 1), 0.8)),
-        Sphere(Vec3(0, 0, 1e12 + 50), 1e12, PURPLE, new Metal(Vec3(1, 1, 1), 0.8)),
-        Sphere(Vec3(-6.5 + 50, 6, -2), 6, SILVER, new Metal(Vec3(1, 1, 1), 0.05)),
-        Sphere(Vec3(4.5 + 50, 4, -2), 4, BLUE, new Lambertian(new ConstantTexture(BLUE))),
-        Sphere(Vec3(50, 3, 5), 3, WHITE, new Dielectric(1.5)),
-        Sphere(Vec3(50, 2, 11), 2, WHITE, new Lambertian(earth)),
-        Sphere(Vec3(-6 + 50, 2, 7), 2, WHITE, new Lambertian(mars)),
-        Sphere(Vec3(6 + 50, 2, 7), 2, WHITE, new Lambertian(moon)),
-    };
-
-    // Add random Spheres.
-    for (int i = 0; i < 50; i++)
+    // Parse command line options.
+    RenderSettings settings;
+    const char *heatmap = NULL;
+    const char *outfile = "output.ppm";
+    const char *format = NULL;
+    const char *stats_file = NULL;
+    const char *tile_heatmap = NULL;
+    int first_frame = 0, last_frame = -1;
+    const char *aov_prefix = NULL;
+    const char *preview_file = NULL;
+    int preview_port = 0;
+    for (int a = 1; a < argc; a++)
     {
-        // Set x coordinate.
-        double x = RandDouble();
-        if (x < 0.5)
-            x = RandDouble(0, 43);
-        else
-            x = RandDouble(56, 100);
-        // Set z coordinate.
-        double z = RandDouble();
-        if (z < 0.5)
-            z = RandDouble(-20, -3);
-        else
-            z = RandDouble(12, 20);
-        // Set radius.
-        double r = RandDouble(0.2, 1);
-        // Set location and color.
-        Vec3 location(x, r, z);
-        Vec3 color(RandDouble(), RandDouble(), RandDouble());
-        double rand = RandDouble();
-        if (rand < 0.45)
+        if ((!strcmp(argv[a], "-t") || !strcmp(argv[a], "--threads")) && a + 1 < argc)
+            settings.threads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--tile-size") && a + 1 < argc)
+            settings.tilesize = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--brute-force"))
+            settings.brute_force = true;
+        else if (!strcmp(argv[a], "--simd") && a + 1 < argc)
+            settings.simd = argv[++a];
+        else if (!strcmp(argv[a], "--rr-depth") && a + 1 < argc)
+            settings.rr_depth = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--rr-threshold") && a + 1 < argc)
+            settings.rr_threshold = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--no-light-sampling"))
+            settings.light_sampling = false;
+        else if (!strcmp(argv[a], "--adaptive"))
+            settings.adaptive.enabled = true;
+        else if (!strcmp(argv[a], "--min-spp") && a + 1 < argc)
+            settings.adaptive.min_spp = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--max-spp") && a + 1 < argc)
+            settings.adaptive.max_spp = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--noise-threshold") && a + 1 < argc)
+            settings.adaptive.threshold = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--heatmap") && a + 1 < argc)
+            heatmap = argv[++a];
+        else if ((!strcmp(argv[a], "-o") || !strcmp(argv[a], "--output")) && a + 1 < argc)
+            outfile = argv[++a];
+        else if (!strcmp(argv[a], "--format") && a + 1 < argc)
+            format = argv[++a];
+        else if (!strcmp(argv[a], "--checkpoint") && a + 1 < argc)
+            settings.checkpoint_file = argv[++a];
+        else if (!strcmp(argv[a], "--checkpoint-interval") && a + 1 < argc)
+            settings.checkpoint_interval = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--resume"))
+            settings.resume = true;
+        else if (!strcmp(argv[a], "--scene") && a + 1 < argc)
+            settings.scene_file = argv[++a];
+        else if (!strcmp(argv[a], "--size") && a + 2 < argc)
         {
-            spheres.push_back(Sphere(location, r, color, new Lambertian(new ConstantTexture(color))));
+            settings.width = atoi(argv[++a]);
+            settings.height = atoi(argv[++a]);
         }
-        else if (rand < 0.75)
+        else if (!strcmp(argv[a], "--spp") && a + 1 < argc)
+            settings.spp = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--crop") && a + 4 < argc)
         {
-            spheres.push_back(Sphere(location, r, color, new Metal(Vec3(1, 1, 1), 0.1)));
+            settings.crop_x0 = atoi(argv[++a]);
+            settings.crop_y0 = atoi(argv[++a]);
+            settings.crop_x1 = atoi(argv[++a]);
+            settings.crop_y1 = atoi(argv[++a]);
+        }
+        else if (!strcmp(argv[a], "--downscale") && a + 1 < argc)
+            settings.downscale = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--integrator") && a + 1 < argc && !strcmp(argv[a + 1], "path"))
+            settings.wavefront = false, a++;
+        else if (!strcmp(argv[a], "--integrator") && a + 1 < argc && !strcmp(argv[a + 1], "wavefront"))
+            settings.wavefront = true, a++;
+        else if (!strcmp(argv[a], "--stats") && a + 1 < argc)
+            stats_file = argv[++a];
+        else if (!strcmp(argv[a], "--tile-heatmap") && a + 1 < argc)
+            tile_heatmap = argv[++a];
+        else if (!strcmp(argv[a], "--worker") && a + 1 < argc)
+            settings.worker_dir = argv[++a];
+        else if (!strcmp(argv[a], "--merge") && a + 1 < argc)
+            settings.merge_dir = argv[++a];
+        else if (!strcmp(argv[a], "--denoise"))
+            settings.denoise = true;
+        else if (!strcmp(argv[a], "--aov") && a + 1 < argc)
+            aov_prefix = argv[++a];
+        else if (!strcmp(argv[a], "--sampler") && a + 1 < argc && ParseSamplerType(argv[a + 1], settings.sampler))
+            a++;
+        else if (!strcmp(argv[a], "--progressive"))
+            settings.progressive = true;
+        else if (!strcmp(argv[a], "--time-limit") && a + 1 < argc)
+            settings.time_limit = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--preview") && a + 1 < argc)
+            preview_file = argv[++a];
+        else if (!strcmp(argv[a], "--preview-port") && a + 1 < argc)
+            preview_port = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--preview-passes") && a + 1 < argc)
+            settings.preview_passes = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--preview-interval") && a + 1 < argc)
+            settings.preview_interval = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--frames") && a + 2 < argc)
+        {
+            first_frame = atoi(argv[++a]);
+            last_frame = atoi(argv[++a]);
         }
         else
         {
-            spheres.push_back(Sphere(location, r, color, new Dielectric(1.5)));
+            fprintf(stderr, "Usage: %s [--scene FILE] [--size W H] [--spp N] [--crop X0 Y0 X1 Y1] [--downscale N]\n"
+                            "          [--threads N] [--tile-size N] [--brute-force] [--simd avx2|sse4|scalar]\n"
+                            "          [--integrator path|wavefront] [--sampler random|stratified|sobol|bluenoise]\n"
+                            "          [--rr-depth N] [--rr-threshold X] [--no-light-sampling]\n"
+                            "          [--adaptive] [--min-spp N] [--max-spp N] [--noise-threshold X] [--heatmap FILE]\n"
+                            "          [-o FILE|-] [--format ppm|png|pfm]\n"
+                            "          [--checkpoint FILE] [--checkpoint-interval SECONDS] [--resume]\n"
+                            "          [--stats FILE|-] [--tile-heatmap FILE] [--worker DIR | --merge DIR]\n"
+                            "          [--frames FIRST LAST] [--denoise] [--aov PREFIX]\n"
+                            "          [--progressive] [--time-limit SECONDS] [--preview FILE] [--preview-port PORT]\n"
+                            "          [--preview-passes N] [--preview-interval SECONDS]\n", argv[0]);
+            return 1;
         }
     }
-    return spheres;
-};
-
-// Obtain the color of a ray.
-Vec3 RayColor(const Ray &ray, const vector<Sphere> &spheres, int depth)
-{
-    // Check if the depth is too large.
-    if (depth <= 0)
-        return Vec3();
-
-    // Check if the ray intersects with any spheres.
-    bool hit = false;
-    double temp = INFINITY;
-    Sphere sphere;
-    HitRecord rec;
-    for (Sphere sph : spheres)
+    settings.keep_aovs = aov_prefix != NULL;
+#ifndef RT_STATS
+    if (stats_file != NULL || tile_heatmap != NULL)
     {
-        HitRecord r;
-        bool h = sph.hit(ray, r, 0.001, temp);
-        if (r.t > 0.0 && h)
-        {
-            hit = true;
-            if (r.t < temp)
-            {
-                sphere = sph;
-                temp = r.t;
-                rec = r;
-            }
-        }
+        fprintf(stderr, "ERROR: --stats and --tile-heatmap need a build with statistics (make STATS=1).\n");
+        return 1;
     }
+#endif
 
-    // If hit, return the color scattered from the sphere.
-    if (hit)
+    // Load the scene.
+    Renderer renderer;
+    if (!renderer.load(settings))
+        return 1;
+    // Render every frame of the animation unless asked for a range.
+    if (last_frame < 0)
+        last_frame = renderer.frames() - 1;
+    if (first_frame < 0 || first_frame > last_frame || last_frame >= renderer.frames())
     {
-        Ray scattered;
-        Vec3 attenuation;
-        if (sphere.material == NULL)
-            return sphere.color;
-        else
-        {
-            if (sphere.material->scatter(ray, rec, scattered, attenuation))
-            {
-                return attenuation * sphere.color * RayColor(scattered, spheres, depth - 1);
-            }
-            else
-            {
-                return Vec3();
-            }
-        }
+        fprintf(stderr, "ERROR: The scene has frames 0 to %d.\n", renderer.frames() - 1);
+        return 1;
+    }
+    if (first_frame != last_frame &&
+        (!settings.checkpoint_file.empty() || !settings.worker_dir.empty() || !settings.merge_dir.empty()))
+    {
+        fprintf(stderr, "ERROR: --checkpoint, --worker and --merge work on one frame; pick it with --frames N N.\n");
+        return 1;
     }
+    const bool animation = first_frame != last_frame;
+    const int width = renderer.width();
+    const int height = renderer.height();
+    const int threads = renderer.threads();
 
-    // If not hit, return background color.
-    Vec3 unitvec = normalize(ray.dir);
-    temp = 0.5 * ((unitvec.y) + 1.0);
-    return temp * Vec3(0, 0, 0);
-};
+    // Report progress, and publish previews to a file, a pipe or over HTTP.
+    Preview preview;
+    if (preview_file != NULL)
+        preview.open_file(preview_file);
+    if (preview_port > 0 && !preview.listen_http(preview_port))
+        return 1;
+    RenderCallbacks callbacks;
+    callbacks.progress = [&](const RenderProgress &p) {
+        if (p.passes > 1)
+            fprintf(stderr, "\rRender progress: %5.2f%% (pass %d of %d, %d spp, %d threads)", 100. * p.done,
+                    p.pass + 1, p.passes, p.spp, threads);
+        else
+            fprintf(stderr, "\rRender progress: %5.2f%% (%d threads)", 100. * p.done, threads);
+    };
+    if (preview.enabled())
+        callbacks.preview = [&](const float *rgb, int w, int h) { preview.publish(rgb, w, h); };
 
-// Main function.
-int main()
-{
-    // Set up scene parameters.
-    const int width = 1280;
-    const int height = 640;
-    const int spp = 3000;
-    const int maxdepth = 50;
-    const double aspectratio = width / height;
+    // Render the frames one after another, each written as soon as it is
+    // done. The scene and its textures stay loaded throughout.
+    vector<float> linear(3 * width * height);
+    for (int frame = first_frame; frame <= last_frame; frame++)
+    {
+        const auto frame_start = chrono::steady_clock::now();
+        if (!renderer.render(frame, linear.data(), callbacks))
+            return 1;
+        if (renderer.stopped())
+            fprintf(stderr, "\nTime limit reached with %d of %d passes complete", renderer.passes_done(),
+                    renderer.passes());
+        fprintf(stderr, "\n");
+        renderer.print_stats(stderr);
 
-    // Set up the camera.
-    Vec3 eyept(50, 8, 25);
-    Vec3 lookat(50, 8, -1);
-    Vec3 up(0, 1, 0);
-    Camera cam(eyept, lookat, up, 90, aspectratio, 0.1, 10);
+        // A worker's output is its part file; the image comes from --merge.
+        if (!settings.worker_dir.empty())
+            return 0;
 
-    // Set up output vectors.
-    Vec3 *output = new Vec3[width * height]();
+        // Output files of an animation are numbered by frame. A name with a
+        // frame number pattern takes the frame even when only one is
+        // rendered.
+        auto frame_file = [&](const char *name) {
+            const bool numbered = animation || (renderer.frames() > 1 && HasFramePattern(name));
+            return numbered ? FrameFileName(name, frame) : string(name);
+        };
 
-    // Set up the scene.
-    const vector<Sphere> spheres = SetUpScene();
+        // Write the image, and give the preview the same.
+        if (!WriteImage(frame_file(outfile).c_str(), ImageFormatFromName(format ? format : outfile), linear.data(),
+                        width, height))
+            return 1;
+        if (preview.enabled())
+            preview.publish(linear.data(), width, height);
+        const int *samples = renderer.sample_counts();
+        if (settings.adaptive.enabled)
+        {
+            long long total_samples = 0;
+            for (int i = 0; i < width * height; i++)
+                total_samples += samples[i];
+            fprintf(stderr, "Average samples per pixel: %.1f\n", static_cast<double>(total_samples) / (width * height));
+        }
 
-    // Render the scene.
-    for (int j = 0; j < height; j++)
-    {
-        fprintf(stderr, "\rScanlines progress: %5.2f%%", 100. * j / (height - 1));
-        for (int i = 0; i < width; i++)
+        // Write the auxiliary images as PFM, which external denoisers read:
+        // albedo, normals mapped from [-1, 1] to [0, 1], and depth.
+        vector<float> image(3 * width * height);
+        if (aov_prefix != NULL)
         {
-            Vec3 color(0, 0, 0);
+            vector<float> depth(width * height);
+            const string prefix = frame_file(aov_prefix);
+            renderer.aovs(image.data(), NULL, NULL);
+            WriteImage((prefix + ".albedo.pfm").c_str(), ImageFormat::PFM, image.data(), width, height);
+            renderer.aovs(NULL, image.data(), depth.data());
+            for (float &n : image)
+                n = 0.5f * n + 0.5f;
+            WriteImage((prefix + ".normal.pfm").c_str(), ImageFormat::PFM, image.data(), width, height);
+            for (int i = 0; i < width * height; i++)
+                image[3 * i] = image[3 * i + 1] = image[3 * i + 2] = depth[i];
+            WriteImage((prefix + ".depth.pfm").c_str(), ImageFormat::PFM, image.data(), width, height);
+        }
 
-            for (int s = 0; s < spp; s++)
+        // Write the sample count heatmap, scaled to the per-pixel limit.
+        if (heatmap != NULL)
+        {
+            for (int i = 0; i < width * height; i++)
             {
-                const double u = (i + RandDouble()) / width;
-                const double v = (j + RandDouble()) / height;
-                Ray r = cam.get_ray(u, v);
-                color += RayColor(r, spheres, maxdepth);
+                const Vec3 heat = HeatColor(static_cast<double>(samples[i]) / renderer.max_samples());
+                image[3 * i + 0] = static_cast<float>(heat.x);
+                image[3 * i + 1] = static_cast<float>(heat.y);
+                image[3 * i + 2] = static_cast<float>(heat.z);
             }
-            color = color / spp;
-            color = Vec3(sqrt(color.x), sqrt(color.y), sqrt(color.z));
-            output[(height - j - 1) * width + i] = color;
+            WriteImage(frame_file(heatmap).c_str(), ImageFormatFromName(heatmap), image.data(), width, height, false);
         }
-    }
 
-    // Write the output to a file.
-    FILE *f = fopen("output.ppm", "w");
-    fprintf(f, "P3\n%d %d\n%d\n", width, height, 255);
-    for (int i = 0; i < width * height; i++)
-    {
-        fprintf(f, "%d %d %d ", (int)(255.999 * output[i].x),
-            (int)(255.999 * output[i].y), (int)(255.999 * output[i].z));
+        // Write the render statistics and the per-tile cost heatmap.
+        const RenderReport &report = renderer.report();
+        if (stats_file != NULL && !report.write(frame_file(stats_file).c_str()))
+            return 1;
+        if (tile_heatmap != NULL)
+        {
+            report.tile_heatmap(width, height, image.data());
+            WriteImage(frame_file(tile_heatmap).c_str(), ImageFormatFromName(tile_heatmap), image.data(), width, height, false);
+        }
+        if (animation)
+        {
+            fprintf(stderr, "Frame %d done in %.3f s (rendering %.3f s)\n", frame,
+                    chrono::duration<double>(chrono::steady_clock::now() - frame_start).count(), report.seconds);
+        }
     }
-    std::cout << "\nDone." << std::endl;
-
-    delete[] output;
+    fprintf(stderr, "Done.\n");
     return 0;
-};
\ No newline at end of file
+};
@@ -0,0 +1,20 @@
+// The stb_image and stb_image_write implementations, compiled once for the
+// whole program.
+
+// Disable pedantic warnings for this external library.
+#ifdef _MSC_VER
+// Microsoft Visual C++ Compiler
+#pragma warning(push, 0)
+#endif
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "external/stb_image.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "external/stb_image_write.h"
+
+// Restore warning levels.
+#ifdef _MSC_VER
+// Microsoft Visual C++ Compiler
+#pragma warning(pop)
+#endif
@@ -1,11 +1,15 @@
 #ifndef UTIL_HEADER_H
 #define UTIL_HEADER_H
 
+#include "Random.hpp"
 #include "Vec3.hpp"
 
 #include <cmath>
+#include <cstddef>
+#include <type_traits>
+#include <variant>
 
-const double pi = 3.1415926535897932385;
+const Real pi = 3.1415926535897932385;
 
 // Degree to radian conversion.
 inline double DegtoRad(double degrees)
@@ -14,58 +18,118 @@ inline double DegtoRad(double degrees)
 };
 
 // Generate random double values between min and max.
-inline double RandDouble(double min = 0.0, double max = 1.0)
+inline double RandDouble(Rng &rng, double min = 0.0, double max = 1.0)
 {
-    return min + rand() / (RAND_MAX / (max - min));
+    return min + (max - min) * rng.next_double();
 };
 
 // Generate random vectors values between min and max.
-inline Vec3 RandVec(double min = 0.0, double max = 1.0)
+inline Vec3 RandVec(Rng &rng, Real min = 0, Real max = 1)
 {
-    return Vec3(RandDouble(min, max), RandDouble(min, max), RandDouble(min, max));
+    const Real x = RandDouble(rng, min, max);
+    const Real y = RandDouble(rng, min, max);
+    const Real z = RandDouble(rng, min, max);
+    return Vec3(x, y, z);
 };
 
-// Generate random unit vectors.
-inline Vec3 RandUnitVec()
+// Map a point of the unit square to a uniformly distributed unit vector.
+inline Vec3 SampleUnitVec(Real u1, Real u2)
 {
-    const double a = RandDouble(0, 2 * pi);
-    const double z = RandDouble(-1, 1);
-    const double r = sqrt(1 - z * z);
+    const Real a = 2 * pi * u1;
+    const Real z = 1 - 2 * u2;
+    const Real r = std::sqrt(std::fmax(Real(0), 1 - z * z));
 
     return Vec3(r * std::cos(a), r * std::sin(a), z);
 };
 
-// Generate random vectors within the unit sphere.
-Vec3 RandVecInUnitSphere()
+// Map a point of the unit cube to a uniformly distributed point in the
+// unit ball: a direction, and a radius from the cube root.
+inline Vec3 SampleInUnitSphere(Real u1, Real u2, Real u3)
 {
-    while (true)
-    {
-        Vec3 v = RandVec(-1.0, 1.0);
-        if (v.length() >= 1.0)
-            continue;
-        return v;
-    }
+    return std::cbrt(u3) * SampleUnitVec(u1, u2);
 };
 
-// Generate random vectors within the unit disk.
-Vec3 RandVecInUnitDisk()
+// Map a point of the unit square to a uniformly distributed point in the
+// unit disk, with Shirley and Chiu's concentric mapping, which keeps
+// neighbouring points together so that stratified samples stay stratified.
+inline Vec3 SampleInUnitDisk(Real u1, Real u2)
 {
-    while (true)
+    const Real x = 2 * u1 - 1;
+    const Real y = 2 * u2 - 1;
+    if (x == 0 && y == 0)
+        return Vec3(0, 0, 0);
+    Real r, theta;
+    if (std::fabs(x) > std::fabs(y))
+    {
+        r = x;
+        theta = pi / 4 * (y / x);
+    }
+    else
     {
-        Vec3 v = Vec3(RandDouble(-1, 1), RandDouble(-1, 1), 0);
-        if (v.length() >= 1.0)
-            continue;
-        return v;
+        r = y;
+        theta = pi / 2 - pi / 4 * (x / y);
     }
+    return Vec3(r * std::cos(theta), r * std::sin(theta), 0);
+};
+
+// Complete the unit vector w to an orthonormal basis (u, v, w), without
+// branching on which axis w is nearest (Duff et al. 2017).
+inline void OrthonormalBasis(const Vec3 &w, Vec3 &u, Vec3 &v)
+{
+    const Real sign = std::copysign(Real(1), w.z);
+    const Real a = -1 / (sign + w.z);
+    const Real b = w.x * w.y * a;
+    u = Vec3(1 + sign * w.x * w.x * a, sign * b, -sign * w.x);
+    v = Vec3(b, sign + w.y * w.y * a, -w.y);
+};
+
+// Generate random unit vectors.
+inline Vec3 RandUnitVec(Rng &rng)
+{
+    const Real u1 = RandDouble(rng);
+    const Real u2 = RandDouble(rng);
+    return SampleUnitVec(u1, u2);
+};
+
+// Generate random vectors within the unit sphere.
+inline Vec3 RandVecInUnitSphere(Rng &rng)
+{
+    const Real u1 = RandDouble(rng);
+    const Real u2 = RandDouble(rng);
+    const Real u3 = RandDouble(rng);
+    return SampleInUnitSphere(u1, u2, u3);
 };
 
 // Get the texture coordinates of the sphere.
-inline void GetSphereUV(const Vec3 &p, double &u, double &v)
+inline void GetSphereUV(const Vec3 &p, Real &u, Real &v)
 {
-    const auto phi = atan2(p.z, p.x);
-    const auto theta = asin(p.y);
+    const auto phi = std::atan2(p.z, p.x);
+    const auto theta = std::asin(p.y);
     u = 1 - (phi + pi) / (2 * pi);
     v = (theta + pi / 2) / pi;
 };
 
-#endif
\ No newline at end of file
+// Position of type T among the alternatives of variant V, for dispatching
+// on variant.index() by name rather than by number.
+template <typename T, typename V>
+struct VariantIndex;
+
+template <typename T, typename... Ts>
+struct VariantIndex<T, std::variant<Ts...>>
+{
+    static constexpr std::size_t find()
+    {
+        constexpr bool match[] = {std::is_same<T, Ts>::value...};
+        for (std::size_t i = 0; i < sizeof...(Ts); i++)
+        {
+            if (match[i])
+                return i;
+        }
+        return sizeof...(Ts);
+    }
+
+    static constexpr std::size_t value = find();
+    static_assert(value < sizeof...(Ts), "type is not an alternative of the variant");
+};
+
+#endif